@@ -0,0 +1,209 @@
+/* Micro-benchmarks of the time types, which the simulator touches on every step.
+
+   Each operation is timed over enough iterations to fill a minimum duration and reported in ns/op,
+   along with heap allocations per op counted by replacing the global operator new. Time and EpochTime
+   versions of each operation are listed side by side so changes to either can be held against the other.
+
+   Usage: ./time_bench [minimum seconds per benchmark, default 0.2]
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <string>
+
+#include "CustomTime.hpp"
+
+/* Counting allocator hook. Every allocation through the global operator new, including those of
+ * std::string and the string streams, increments the counter. Array and nothrow new go through here too */
+static std::atomic<uint64_t> allocation_count{0};
+
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = malloc(size == 0 ? 1 : size)) return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+namespace {
+
+/* Keep the compiler from discarding a result or assuming it knows a value */
+template <typename T>
+inline void keep(T& value) {
+#if defined(__GNUC__)
+  asm volatile("" : : "g"(&value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+/* Number of distinct inputs each benchmark cycles through, so no single value gets constant folded */
+constexpr size_t NUM_INPUTS = 64;
+
+double min_seconds = 0.2;
+
+/* Run op(i) for growing iteration counts until one batch takes at least min_seconds, then print the
+ * time and allocations per op of that batch. Each call of op counts as ops_per_call ops */
+template <typename Op>
+void run(const char* name, Op&& op, size_t ops_per_call = 1) {
+  for (size_t i = 0; i < NUM_INPUTS; i++) op(i);
+
+  for (uint64_t iterations = 1024;; iterations *= 2) {
+    const uint64_t allocations = allocation_count.load(std::memory_order_relaxed);
+    const auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+      op(static_cast<size_t>(i % NUM_INPUTS));
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed.count() >= min_seconds) {
+      const double ops = static_cast<double>(iterations) * static_cast<double>(ops_per_call);
+      const double allocations_per_op =
+          static_cast<double>(allocation_count.load(std::memory_order_relaxed) - allocations) / ops;
+      printf("%-40s %10.2f ns/op %8.2f allocs/op\n", name, elapsed.count() * 1e9 / ops, allocations_per_op);
+      return;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) min_seconds = atof(argv[1]);
+
+  /* Inputs spread over a race week, a few hours apart and with odd milliseconds */
+  std::array<std::string, NUM_INPUTS> strings;
+  std::array<Time, NUM_INPUTS> times;
+  std::array<EpochTime, NUM_INPUTS> epoch_times;
+  std::array<double, NUM_INPUTS> seconds;
+  for (size_t i = 0; i < NUM_INPUTS; i++) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "2023-10-%02zu %02zu:%02zu:%02zu", 22 + i % 7, (i * 5) % 24, (i * 7) % 60,
+             (i * 11) % 60);
+    strings[i] = buffer;
+    times[i] = Time(strings[i], -9.5) + 0.001 * static_cast<double>(i * 37 % 1000);
+    epoch_times[i] = EpochTime(times[i]);
+    seconds[i] = 0.5 + static_cast<double>(i) * 13.25;
+  }
+  std::array<std::string, NUM_INPUTS> hh_mm_ss;
+  for (size_t i = 0; i < NUM_INPUTS; i++) hh_mm_ss[i] = strings[i].substr(11);
+
+  printf("%-40s %16s %18s\n", "benchmark", "time", "allocations");
+
+  /* Construction */
+  run("Time(\"YYYY-MM-DD HH:MM:SS\", adjustment)", [&](size_t i) {
+    Time time(strings[i], -9.5);
+    keep(time);
+  });
+  run("Time(\"HH:MM:SS\")", [&](size_t i) {
+    Time time(hh_mm_ss[i]);
+    keep(time);
+  });
+  run("EpochTime::from_civil", [&](size_t i) {
+    unsigned day = static_cast<unsigned>(22 + i % 7);
+    keep(day);
+    EpochTime time = EpochTime::from_civil(2023, 10, day, 10, 30, 0, -9.5);
+    keep(time);
+  });
+  run("EpochTime(const Time&)", [&](size_t i) {
+    EpochTime time(times[i]);
+    keep(time);
+  });
+  run("Time(EpochTime)", [&](size_t i) {
+    Time time = epoch_times[i];
+    keep(time);
+  });
+
+  /* Arithmetic */
+  run("Time + seconds", [&](size_t i) {
+    Time time = times[i] + seconds[i];
+    keep(time);
+  });
+  run("EpochTime + seconds", [&](size_t i) {
+    EpochTime time = epoch_times[i] + seconds[i];
+    keep(time);
+  });
+  run("Time - Time", [&](size_t i) {
+    double difference = times[i] - times[(i + 1) % NUM_INPUTS];
+    keep(difference);
+  });
+  run("EpochTime - EpochTime", [&](size_t i) {
+    double difference = epoch_times[i] - epoch_times[(i + 1) % NUM_INPUTS];
+    keep(difference);
+  });
+  {
+    Time time = times[0];
+    run("Time::update_time_seconds", [&](size_t i) {
+      time.update_time_seconds(seconds[i]);
+      keep(time);
+    });
+    EpochTime epoch_time = epoch_times[0];
+    run("EpochTime = EpochTime + seconds", [&](size_t i) {
+      epoch_time = epoch_time + seconds[i];
+      keep(epoch_time);
+    });
+  }
+
+  /* Comparisons, all four per op */
+  run("Time < > <= >=", [&](size_t i) {
+    const Time& a = times[i];
+    const Time& b = times[(i + 1) % NUM_INPUTS];
+    int count = (a < b) + (a > b) + (a <= b) + (a >= b);
+    keep(count);
+  });
+  run("EpochTime < > <= >=", [&](size_t i) {
+    const EpochTime& a = epoch_times[i];
+    const EpochTime& b = epoch_times[(i + 1) % NUM_INPUTS];
+    int count = (a < b) + (a > b) + (a <= b) + (a >= b);
+    keep(count);
+  });
+
+  /* Calendar fields and formatting */
+  run("EpochTime::get_local_civil", [&](size_t i) {
+    CivilTime civil = epoch_times[i].get_local_civil();
+    keep(civil);
+  });
+  run("Time::get_local_readable_time", [&](size_t i) {
+    std::string text = times[i].get_local_readable_time();
+    keep(text);
+  });
+  run("EpochTime::get_local_readable_time", [&](size_t i) {
+    std::string text = epoch_times[i].get_local_readable_time();
+    keep(text);
+  });
+  run("Time::get_utc_readable_time", [&](size_t i) {
+    std::string text = times[i].get_utc_readable_time();
+    keep(text);
+  });
+  run("EpochTime::get_utc_readable_time", [&](size_t i) {
+    std::string text = epoch_times[i].get_utc_readable_time();
+    keep(text);
+  });
+  char text[64];
+  run("Time::to_local_chars", [&](size_t i) {
+    std::to_chars_result result = times[i].to_local_chars(text, text + sizeof(text));
+    keep(result);
+  });
+  run("EpochTime::to_local_chars", [&](size_t i) {
+    std::to_chars_result result = epoch_times[i].to_local_chars(text, text + sizeof(text));
+    keep(result);
+  });
+
+  /* Bulk formatting of a column of times one simulation step apart, reported per time */
+  std::array<EpochTime, 1024> column;
+  for (size_t i = 0; i < column.size(); i++) column[i] = epoch_times[0] + 30.0 * static_cast<double>(i);
+  std::array<char, column.size() * (READABLE_TIME_SIZE + 1)> column_text;
+  run("format_epoch_times, per time", [&](size_t) {
+    std::to_chars_result result = format_epoch_times(column_text.data(), column_text.data() + column_text.size(),
+                                                     column);
+    keep(result);
+  }, column.size());
+  return 0;
+}
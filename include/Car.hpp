@@ -1,25 +1,278 @@
 #pragma once
 
+#include <cmath>
 #include <memory>
+#include <span>
+#include <string>
 
-#ifndef CAR_HPP
-class Car {
+#include "Utils.hpp"
+#include "Luts.hpp"
+
+/* Physical parameters of a car. The defaults are the production car */
+struct CarParams {
+  double air_density = 1.225;          // Air density (kg/m^3)
+  double cda = 0.15;                   // Drag area (m^2)
+  double rolling_resistance = 0.0026;  // Rolling resistance coefficient
+  double car_mass = 283.0;             // Car mass (kg)
+  double gravity = 9.81;               // Acceleration due to gravity (m/s^2)
+  double passive_loss = 20.0;          // Passive electric loss (W)
+  double array_area = 4.0;             // Solar array area (m^2)
+  double array_efficiency = 0.252;     // Solar array efficiency
+  double battery_efficiency = 0.98;    // Battery efficiency
+  double motor_efficiency = 0.8;       // Motor efficiency, unless the car has a motor map
+  double wheel_radius = 0.28;          // Wheel radius (m), to turn speed and force into motor speed and torque
+};
+
+/* Parameters of the production car, fixed at compile time */
+inline constexpr CarParams PRODUCTION_CAR_PARAMS{};
+
+/* Temperature (degrees C) at which CarParams::air_density applies, the standard atmosphere at sea level */
+inline constexpr double REFERENCE_AIR_TEMPERATURE = 15.0;
+
+/* Air density relative to CarParams::air_density at a temperature (degrees C), at constant pressure */
+inline double air_density_ratio(double temperature) {
+  return (REFERENCE_AIR_TEMPERATURE + CELSIUS_TO_KELVIN) / (temperature + CELSIUS_TO_KELVIN);
+}
+
+/** @brief Read car parameters from a config file
+ *
+ * One `name = value` pair per line, named after the CarParams fields. Text after '#' is a comment.
+ * Parameters that are not listed keep their production car values.
+ *
+ * @param path: Path to the config file
+ */
+CarParams load_car_params(const std::string& path);
+
+/* Speed independent coefficients of the energy model. At velocity v (m/s) on an incline theta
+ * under irradiance G (W/m^2), the net battery power (W) is
+ *   solar * G - (cubic * v^3 + (linear + grade * sin(theta)) * v + constant)
+ */
+struct PowerCoefficients {
+  double cubic;     // Aerodynamic drag (W s^3/m^3)
+  double linear;    // Rolling resistance (W s/m)
+  double grade;     // Gravity per unit sin(theta) (W s/m)
+  double constant;  // Passive electrical load (W)
+  double solar;     // Array gain into the battery (m^2)
+  double array;     // Array gain at the battery terminals, before battery losses (m^2)
+};
+
+/** @brief Evaluate the energy model for many inputs at once, using the widest vector instructions
+ * the CPU supports. Every level gives bitwise the same results. For a non-negative velocity[i], element i
+ * of out is bitwise energy_consumption(velocity[i], theta, irradiance[i]) for a car with these parameters
+ * and any incline theta with sin(theta) == sin_grade[i], e.g. sin_grade[i] = sin(theta). Note that
+ * sin(asin(s)) is not always s, so passing asin(sin_grade[i]) to the scalar model can differ in the last bits
+ *
+ * @param params: Car parameters
+ * @param velocity: Speeds (m/s)
+ * @param sin_grade: Sines of the inclines
+ * @param irradiance: Irradiance values (W/m^2)
+ * @param out: Net battery power (W), same length as the inputs
+ * @param level: Instruction set to use. Levels the CPU does not support fall back to scalar
+ */
+void energy_consumption_batch(const CarParams& params, std::span<const double> velocity,
+                              std::span<const double> sin_grade, std::span<const double> irradiance,
+                              std::span<double> out, SimdLevel level = detect_simd_level());
+
+/** @brief Inverse of the energy model for many stretches at once: the fastest constant speed (m/s) that drives
+ * each stretch on a given battery energy, like speed_for_energy. Uses the widest vector instructions the CPU
+ * supports. Results agree with speed_for_energy to about 1e-12 relative
+ *
+ * @param params: Car parameters
+ * @param energy: Battery energy budget of each stretch (J)
+ * @param distance: Length of each stretch (m). Must be positive
+ * @param sin_grade: Sine of the incline of each stretch
+ * @param irradiance: Irradiance on the array over each stretch (W/m^2)
+ * @param out: Speeds (m/s), same length as the inputs. NaN where no speed fits the budget
+ * @param level: Instruction set to use. Levels the CPU does not support fall back to scalar
+ */
+void speed_for_energy_batch(const CarParams& params, std::span<const double> energy, std::span<const double> distance,
+                            std::span<const double> sin_grade, std::span<const double> irradiance,
+                            std::span<double> out, SimdLevel level = detect_simd_level());
+
+/* Energy model shared by every car type. Derived classes only supply their parameters through
+ * params(), so the whole model is visible to the compiler and inlines into the simulator */
+template <typename Derived>
+class CarModel {
  private:
-  /* Define car parameters here according to the doc */
+  inline const CarParams& p() const { return static_cast<const Derived&>(*this).params(); }
+
+ protected:
   // Private methods for calculating each loss/gain component
-  
-    double calc_aero_loss(double velocity);
-    double calc_rolling_loss(double velocity);
-    double calc_gravity_loss(double velocity, double angle);
-    double calc_solar_gain(double irradiance);
+
+  // Calculate aerodynamic loss (W). Drag follows the air speed, velocity plus headwind (m/s), and
+  // scales with air density relative to CarParams::air_density
+  inline double calc_aero_loss(double velocity, double headwind = 0.0, double density_ratio = 1.0) const {
+    const double air_speed = velocity + headwind;
+    return 0.5 * p().air_density * p().cda * air_speed * std::abs(air_speed) * velocity * density_ratio;
+  }
+
+  // Calculate rolling resistance loss (W)
+  inline double calc_rolling_loss(double velocity) const {
+    return p().rolling_resistance * p().car_mass * p().gravity * velocity;
+  }
+
+  // Calculate gravitational loss/gain (W)
+  inline double calc_gravity_loss(double velocity, double angle) const {
+    return p().car_mass * p().gravity * velocity * sin(angle);
+  }
+
+  // Calculate solar energy gain (W)
+  inline double calc_solar_gain(double irradiance) const {
+    return irradiance * p().array_area * p().array_efficiency;
+  }
 
  public:
-  Car();
+  // Battery model, or nullptr for an ideal battery whose only loss is battery_efficiency on solar gain
+  inline const BatteryLut* get_battery() const { return static_cast<const Derived&>(*this).battery(); }
+
+  // Motor efficiency map, or nullptr for a constant motor_efficiency
+  inline const MotorLut* get_motor() const { return static_cast<const Derived&>(*this).motor(); }
+
+  // Motor speed (rpm) of an in-wheel motor at a road speed (m/s)
+  inline double calc_motor_speed(double velocity) const {
+    return velocity / p().wheel_radius * MINUTES_TO_SECONDS / (2 * PI);
+  }
+
+  // Motor efficiency map at one road speed (m/s), to pass to the power calculations while the speed is constant
+  inline MotorSlice motor_slice(double velocity) const { return get_motor()->slice(calc_motor_speed(velocity)); }
+
+  // Electrical power (W) the motor exchanges for a mechanical power (W) at the wheels. With a motor
+  // map, the efficiency comes from the motor's speed and torque, and regeneration (negative power)
+  // returns the mechanical power times the efficiency. A slice of the map at this velocity skips the
+  // speed lookup. Without a map, every power is divided by motor_efficiency
+  inline double calc_motor_power(double velocity, double mechanical_power, const MotorSlice* slice = nullptr) const {
+    const MotorLut* motor = get_motor();
+    if (motor == nullptr)
+      return mechanical_power / p().motor_efficiency;
+    const double torque = mechanical_power / velocity * p().wheel_radius;
+    const double efficiency = slice ? slice->get_efficiency(torque) : motor->get_efficiency(calc_motor_speed(velocity), torque);
+    return mechanical_power * (mechanical_power >= 0 ? 1.0 / efficiency : efficiency);
+  }
+
+  // Power at the battery terminals (W), the array output less the motor and electrical load.
+  // Positive when charging. The battery model turns it into a change of stored energy
+  inline double terminal_power(double velocity, double angle, double irradiance, double headwind = 0.0,
+                               double density_ratio = 1.0, const MotorSlice* motor_slice = nullptr) const {
+    double aero = calc_aero_loss(velocity, headwind, density_ratio);
+    double rolling = calc_rolling_loss(velocity);
+    double gravity = calc_gravity_loss(velocity, angle);
+    double solar = calc_solar_gain(irradiance);
+    return solar - (calc_motor_power(velocity, aero + rolling + gravity, motor_slice) + p().passive_loss);
+  }
+
   // Energy consumption calculation (W)
-  double energy_consumption(double velocity, double angle, double irradiance);
-  
-  // Define energy loss functions
+  // Positive value indicates battery charging, negative indicates discharging
+  // Without weather, i.e. no headwind and the reference air density, aero loss is exactly the still air model
+  inline double energy_consumption(double velocity, double angle, double irradiance, double headwind = 0.0,
+                                   double density_ratio = 1.0, const MotorSlice* motor_slice = nullptr) const {
+    double aero = calc_aero_loss(velocity, headwind, density_ratio);
+    double rolling = calc_rolling_loss(velocity);
+    double gravity = calc_gravity_loss(velocity, angle);
+    double solar = calc_solar_gain(irradiance);
+
+    double total_losses = calc_motor_power(velocity, aero + rolling + gravity, motor_slice) + p().passive_loss;
+
+    // Net power = solar gain - total losses, adjusted for battery efficiency
+    return solar * p().battery_efficiency - total_losses;
+  }
+
+  // Energy consumption for many segments at once (W). Takes the sine of each incline rather than
+  // the angle. Uses AVX2 or AVX-512 when available. Always uses motor_efficiency, never a motor map
+  inline void energy_consumption_batch(std::span<const double> velocity, std::span<const double> sin_grade,
+                                       std::span<const double> irradiance, std::span<double> out) const {
+    ::energy_consumption_batch(p(), velocity, sin_grade, irradiance, out);
+  }
+
+  // Coefficients of the energy model, for evaluating many speeds without calling energy_consumption.
+  // They use motor_efficiency, so they ignore a motor map, as do the inverse models below
+  inline PowerCoefficients get_power_coefficients() const {
+    PowerCoefficients k;
+    k.cubic = 0.5 * p().air_density * p().cda / p().motor_efficiency;
+    k.linear = p().rolling_resistance * p().car_mass * p().gravity / p().motor_efficiency;
+    k.grade = p().car_mass * p().gravity / p().motor_efficiency;
+    k.constant = p().passive_loss;
+    k.solar = p().array_area * p().array_efficiency * p().battery_efficiency;
+    k.array = p().array_area * p().array_efficiency;
+    return k;
+  }
+
+  // Speed (m/s) at which the net battery power is net_power (W) on an incline under some irradiance,
+  // i.e. the inverse of energy_consumption in still air. Solves cubic * v^3 + b * v + c = 0 in closed form,
+  // where b = linear + grade * sin(angle) and c = constant - solar * irradiance + net_power. Takes the faster
+  // root when two speeds fit, e.g. downhill. NaN if no speed draws that little
+  inline double speed_for_power(double net_power, double angle, double irradiance) const {
+    const PowerCoefficients k = get_power_coefficients();
+    return largest_cubic_root(k.cubic, k.linear + k.grade * sin(angle), k.constant - k.solar * irradiance + net_power);
+  }
 
+  // Fastest constant speed (m/s) that drives distance (m) on an incline under some irradiance using
+  // exactly energy (J) from the battery. Battery energy over the stretch is (cubic * v^3 + b * v + c) * d / v,
+  // so this solves cubic * v^3 + (b - energy / d) * v + c = 0 with c net of solar gain. NaN if no speed fits.
+  // The distance must be positive
+  inline double speed_for_energy(double energy, double distance, double angle, double irradiance) const {
+    RUNTIME_EXCEPTION(distance > 0, "Stretch distance must be positive, got " << distance);
+    const PowerCoefficients k = get_power_coefficients();
+    return largest_cubic_root(k.cubic, k.linear + k.grade * sin(angle) - energy / distance,
+                              k.constant - k.solar * irradiance);
+  }
+
+  // speed_for_energy for many stretches at once. Takes the sine of each incline rather than the angle
+  inline void speed_for_energy_batch(std::span<const double> energy, std::span<const double> distance,
+                                     std::span<const double> sin_grade, std::span<const double> irradiance,
+                                     std::span<double> out) const {
+    ::speed_for_energy_batch(p(), energy, distance, sin_grade, irradiance, out);
+  }
+
+  // Energy (J) drawn from the battery to drive a stretch of route at a constant velocity,
+  // ignoring any solar gain along the way. Power is cubic + linear terms in v, so energy over a
+  // distance d at speed v is (cubic * v^2 + linear) * d + grade * climb + constant * d / v.
+  // aero_scale multiplies the drag term, e.g. with a bound on the effect of wind and air density.
+  // With a motor map this is a lower bound, as if the motor ran at the map's peak efficiency throughout
+  inline double drive_energy(double velocity, const RouteAggregate& stretch, double aero_scale = 1.0) const {
+    const PowerCoefficients k = get_power_coefficients();
+    const double motor_scale = get_motor() ? p().motor_efficiency / get_motor()->get_max_efficiency() : 1.0;
+    return ((k.cubic * aero_scale * velocity * velocity + k.linear) * stretch.distance + k.grade * stretch.climb) *
+           motor_scale + k.constant * stretch.distance / velocity;
+  }
+};
+
+/* Car with its parameters fixed at compile time. Every parameter is a constant in the energy
+ * model, so the simulator's hot loop folds them in. Use for the production car */
+template <const CarParams& Params>
+class StaticCar : public CarModel<StaticCar<Params>> {
+ public:
+  static constexpr const CarParams& params() { return Params; }
+  static constexpr const BatteryLut* battery() { return nullptr; }
+  static constexpr const MotorLut* motor() { return nullptr; }
 };
 
-#endif // CAR_HPP
+/* The production car on the compile time fast path */
+using ProductionCar = StaticCar<PRODUCTION_CAR_PARAMS>;
+
+/* Car with parameters chosen at runtime, e.g. for design studies. Same interface as StaticCar */
+class Car : public CarModel<Car> {
+ private:
+  /* Define car parameters here according to the doc */
+  CarParams car_params;
+
+  /* Optional battery model and motor map. Shared, as they are read only */
+  std::shared_ptr<const BatteryLut> battery_lut;
+  std::shared_ptr<const MotorLut> motor_lut;
+
+ public:
+  /* The production car */
+  Car();
+
+  /* A car with custom parameters */
+  explicit Car(const CarParams& params);
+
+  inline const CarParams& params() const { return car_params; }
+  inline const BatteryLut* battery() const { return battery_lut.get(); }
+
+  /* Model the battery with a table instead of a flat battery_efficiency. nullptr goes back to the ideal battery */
+  inline void set_battery(std::shared_ptr<const BatteryLut> lut) { battery_lut = lut; }
+
+  /* Model the motor with an efficiency map instead of a flat motor_efficiency. nullptr goes back to the constant */
+  inline const MotorLut* motor() const { return motor_lut.get(); }
+  inline void set_motor(std::shared_ptr<const MotorLut> lut) { motor_lut = lut; }
+};
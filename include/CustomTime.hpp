@@ -9,13 +9,58 @@
 
 #pragma once
 
+#include <charconv>
 #include <chrono>
+#include <cstdint>
 #include <ctime>
 #include <iostream>
+#include <span>
 #include <string>
+#include <string_view>
 
 #include "date.h"
 
+/** @brief Days since 1970-01-01 of a proleptic Gregorian calendar date
+ * Same arithmetic as the date library's days_from_civil, without building its calendar types
+ * @param year: Full year, e.g. 2023
+ * @param month: Month from 1 to 12
+ * @param day: Day of the month from 1
+ */
+constexpr int64_t days_from_civil(int64_t year, unsigned month, unsigned day) {
+  year -= month <= 2;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t year_of_era = year - era * 400;
+  const int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+/** @brief Seconds since the epoch of a calendar date and time of day. No timezone conversion is done */
+constexpr int64_t epoch_from_civil(int64_t year, unsigned month, unsigned day,
+                                   unsigned hour, unsigned minute, unsigned second) {
+  return days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+/** @brief Seconds since local midnight of a time of day */
+constexpr int64_t time_of_day(unsigned hour, unsigned minute, unsigned second) {
+  return hour * 3600 + minute * 60 + second;
+}
+
+/** @brief Convert a packed YYMMDDHHMMSS timestamp, as used in forecast headers, to seconds since the epoch
+ * Two digit years are in the 2000s
+ * @param packed: Timestamp digits as an integer, e.g. 231022100000 for 2023-10-22 10:00:00
+ * @param epoch: Set to the converted time on success
+ * @return False if a field is out of range
+ */
+bool packed_timestamp_to_epoch(uint64_t packed, time_t* epoch);
+
+/** @brief Parse a zero padded YYYY-MM-DD HH:MM:SS timestamp into seconds since the epoch
+ * @param time_point: Timestamp string. Trailing characters after the seconds are not allowed
+ * @param epoch: Set to the parsed time on success
+ * @return False if time_point is not exactly in that form or a field is out of range
+ */
+bool parse_date_time(std::string_view time_point, time_t* epoch);
+
 // A class used to represent a timestamp with a certain UTC adjustment
 class Time {
  private:
@@ -44,6 +89,8 @@ class Time {
   */
   void HH_MM_SS_constructor(const std::string local_time_point);
 
+  friend class EpochTime;
+
  public:
   Time() {}
 
@@ -109,4 +156,154 @@ class Time {
 
   /** Get human readable utc time as a string */
   std::string get_utc_readable_time() const;
+
+  /** @brief Write the human readable local time into a buffer, like std::to_chars. Allocation free
+   * @return Pointer past the last character written. No terminating null is written. If the buffer is
+   * too small, last and std::errc::value_too_large
+   */
+  std::to_chars_result to_local_chars(char* first, char* last) const;
+
+  /** @brief Write the human readable utc time into a buffer, as for to_local_chars */
+  std::to_chars_result to_utc_chars(char* first, char* last) const;
+};
+
+/* Calendar fields of a timestamp. month and day are one based, unlike in tm */
+struct CivilTime {
+  int year;
+  unsigned month;
+  unsigned day;
+  unsigned hour;
+  unsigned minute;
+  unsigned second;
+  unsigned millisecond;
+};
+
+/* Characters in a human readable timestamp, YYYY-MM-DD HH:MM:SS.mmm, for years 0 to 9999 */
+inline constexpr size_t READABLE_TIME_SIZE = 23;
+
+/** @brief Write calendar fields as YYYY-MM-DD HH:MM:SS.mmm into a buffer, like std::to_chars
+ * Allocation free and takes no locks, so it is safe to call from any thread
+ * @return Pointer past the last character written. No terminating null is written. If the buffer is
+ * too small, last and std::errc::value_too_large
+ */
+std::to_chars_result format_civil_time(char* first, char* last, const CivilTime& civil);
+
+/** @brief Format many epoch times back to back, e.g. the timestamp column of a trace or csv file
+ *
+ * Writes each time as YYYY-MM-DD HH:MM:SS.mmm followed by the separator. A time on the same day as the
+ * one before it reuses its date, so a run of nearby times costs a few integer divisions each.
+ *
+ * @param epoch_milliseconds: Times as milliseconds since the epoch
+ * @param separator: Character written after each time, e.g. '\n' or ','
+ * @return As for format_civil_time. A buffer of (READABLE_TIME_SIZE + 1) characters per time is large enough
+ */
+std::to_chars_result format_epoch_times(char* first, char* last, std::span<const int64_t> epoch_milliseconds,
+                                        char separator = '\n');
+
+/* A timestamp as local milliseconds since the epoch plus a UTC adjustment. Unlike Time it holds no
+   calendar fields or strings, so copies, arithmetic and comparisons are plain integer operations.
+   Calendar fields are only computed when asked for.
+   Note: Comparisons and differences ignore the UTC adjustment, as Time's do. Both sides are
+   expected to share one adjustment
+*/
+class EpochTime {
+ private:
+  /* Milliseconds since the epoch of the local time */
+  int64_t local_ms = 0;
+
+  /* UTC adjustment in milliseconds, added to the local time to get utc */
+  int64_t utc_adjustment_ms = 0;
+
+ public:
+  constexpr EpochTime() {}
+
+  /** @brief Create time from local milliseconds since the epoch
+   *
+   * @param local_milliseconds Milliseconds since the epoch of the local time
+   * @param utc_adjustment Adjustment in hours from local time to utc, as for Time
+  */
+  constexpr EpochTime(int64_t local_milliseconds, double utc_adjustment)
+      : local_ms(local_milliseconds), utc_adjustment_ms(hours_to_ms(utc_adjustment)) {}
+
+  /** @brief Create time from a local calendar date and time of day. Usable in constant expressions,
+   * e.g. static constexpr EpochTime race_end = EpochTime::from_civil(2023, 10, 28, 17, 0, 0, -9.5);
+   *
+   * @param utc_adjustment Adjustment in hours from local time to utc, as for Time
+  */
+  static constexpr EpochTime from_civil(int64_t year, unsigned month, unsigned day,
+                                        unsigned hour, unsigned minute, unsigned second, double utc_adjustment) {
+    return EpochTime(epoch_from_civil(year, month, day, hour, minute, second) * 1000, utc_adjustment);
+  }
+
+  /** Convert from a Time with a date. HH:MM:SS only timestamps have no epoch and are rejected */
+  EpochTime(const Time& time);
+
+  /** Convert back to a Time, filling in its calendar fields */
+  operator Time() const;
+
+  /** Get milliseconds since the epoch of the local time */
+  constexpr int64_t get_local_milliseconds() const { return local_ms; }
+
+  /** Get milliseconds since the epoch of the utc time */
+  constexpr int64_t get_utc_milliseconds() const { return local_ms + utc_adjustment_ms; }
+
+  /** Get an epoch timestamp representing the utc time */
+  constexpr time_t get_utc_time_point() const {
+    return static_cast<time_t>(floor_div_ms(get_utc_milliseconds()));
+  }
+
+  /** Get the calendar fields of the local time */
+  CivilTime get_local_civil() const;
+
+  /** Get the calendar fields of the utc time */
+  CivilTime get_utc_civil() const;
+
+  constexpr bool operator>(const EpochTime& other) const { return local_ms > other.local_ms; }
+  constexpr bool operator<(const EpochTime& other) const { return local_ms < other.local_ms; }
+  constexpr bool operator>=(const EpochTime& other) const { return local_ms >= other.local_ms; }
+  constexpr bool operator<=(const EpochTime& other) const { return local_ms <= other.local_ms; }
+  constexpr bool operator==(const EpochTime& other) const { return local_ms == other.local_ms; }
+  constexpr bool operator!=(const EpochTime& other) const { return local_ms != other.local_ms; }
+
+  /** @brief Return the difference between two EpochTime objects in seconds */
+  constexpr double operator-(const EpochTime& other) const {
+    return static_cast<double>(local_ms - other.local_ms) / 1000.0;
+  }
+
+  /** @brief Return a time advanced by a certain number of seconds, truncated to milliseconds like Time */
+  constexpr EpochTime operator+(const double seconds) const {
+    EpochTime new_time(*this);
+    new_time.local_ms += static_cast<int64_t>(seconds * 1000);
+    return new_time;
+  }
+
+  /** Get human readable local time as a string */
+  std::string get_local_readable_time() const;
+
+  /** Get human readable utc time as a string */
+  std::string get_utc_readable_time() const;
+
+  /** @brief Write the human readable local time into a buffer, as for Time::to_local_chars */
+  std::to_chars_result to_local_chars(char* first, char* last) const;
+
+  /** @brief Write the human readable utc time into a buffer, as for Time::to_local_chars */
+  std::to_chars_result to_utc_chars(char* first, char* last) const;
+
+ private:
+  /* Whole seconds of a millisecond count, rounded towards negative infinity */
+  static constexpr int64_t floor_div_ms(const int64_t ms) {
+    return ms / 1000 - (ms % 1000 < 0 ? 1 : 0);
+  }
+
+  /* Hours to the nearest millisecond */
+  static constexpr int64_t hours_to_ms(const double hours) {
+    const double ms = hours * 3600000.0;
+    return static_cast<int64_t>(ms < 0 ? ms - 0.5 : ms + 0.5);
+  }
 };
+
+/** @brief format_epoch_times for EpochTime values
+ * @param utc: Format the utc times instead of the local times
+ */
+std::to_chars_result format_epoch_times(char* first, char* last, std::span<const EpochTime> times,
+                                        bool utc = false, char separator = '\n');
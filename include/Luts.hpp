@@ -6,6 +6,11 @@
    first row represents a series of timestamps. Index using a lat/lon key along with a timestep key in order to 
    obtain an irradiance or wind value.
 
+   4. Motor lookup table. Efficiency of the motor indexed by motor speed and torque.
+
+   5. Battery lookup table. Rows are evenly spaced states of charge, holding the battery's efficiencies
+   and resistive loss factor at that charge.
+
  */
 
 #pragma once
@@ -15,6 +20,9 @@
 #include <string>
 #include <filesystem>
 #include <vector>
+#include <utility>
+#include <algorithm>
+#include <cmath>
 
 #include "Utils.hpp"
 
@@ -29,8 +37,8 @@ class BaseLut {
   std::vector<std::vector<T>> values;
 
   /* Dimensions of the LUT */
-  size_t num_rows;
-  size_t num_cols;
+  size_t num_rows = 0;
+  size_t num_cols = 0;
 
   virtual void load_LUT() = 0;
 
@@ -42,7 +50,26 @@ class BaseLut {
   /* We let the derived LUTs implement their own lookup functionality */
 };
 
-/* Represents a forecast lookup table of double values */
+/* Position of a lookup in a forecast table. Lets sequential queries skip the full key search */
+struct ForecastCursor {
+  size_t row = 0;
+  size_t column = 0;
+};
+
+class SunGeometryLut;
+
+/* Channel names the simulator recognizes in a forecast table */
+inline constexpr const char* IRRADIANCE_CHANNEL = "irradiance";    // W/m^2
+inline constexpr const char* WIND_EAST_CHANNEL = "wind_east";      // Wind velocity towards the east (m/s)
+inline constexpr const char* WIND_NORTH_CHANNEL = "wind_north";    // Wind velocity towards the north (m/s)
+inline constexpr const char* TEMPERATURE_CHANNEL = "temperature";  // Air temperature (degrees C)
+
+/* Represents a forecast lookup table of double values.
+ *
+ * A table can hold several channels, e.g. irradiance, wind and temperature, that share one set of
+ * coordinates and timestamps. Channels are interleaved per cell, values[row][column * num_channels + channel],
+ * so one resolved cursor reads every channel of a cell from the same cache line. Lookups without a
+ * channel and the integrals use channel 0, the csv loaded on construction */
 class ForecastLut : public BaseLut<double>{
  private:
   /* Coordinates used to index the lookup table */
@@ -51,11 +78,15 @@ class ForecastLut : public BaseLut<double>{
   /* Timesteps used to index the lookup table as unix epoch times */
   std::vector<time_t> forecast_times;
 
+  /* Values per cell, and the name of each channel */
+  size_t num_channels = 1;
+  std::vector<std::string> channel_names;
+
   void load_LUT() override;
 
  public:
-  /* Load a csv upon construction */
-  explicit ForecastLut(const std::string path);
+  /* Load a csv upon construction as channel 0 */
+  explicit ForecastLut(const std::string path, const std::string channel_name = IRRADIANCE_CHANNEL);
 
   /* Empty default constructor */
   ForecastLut() {}
@@ -63,6 +94,58 @@ class ForecastLut : public BaseLut<double>{
   /* Get a certain value with lat/lon and unix time as keys. Uses the closest keys */
   double get_value(ForecastCoord coord, time_t time);
 
+  /* Index of the row closest to a coordinate, using the same search as get_value */
+  size_t find_row(ForecastCoord coord) const;
+
+  /* Index of the column closest to a unix time, using the same search as get_value */
+  size_t find_column(time_t time) const;
+
+  /* Move a cursor's column to the one closest to a new time. Only walks the columns in between,
+   * so it is cheap when time moves forward a little at a time */
+  void advance_column(ForecastCursor& cursor, time_t time) const;
+
+  /* Directly index the table with a cursor */
+  inline double get_value(const ForecastCursor& cursor) const {
+    return values[cursor.row][cursor.column * num_channels];
+  }
+
+  /* Every channel of the cell under a cursor, in channel order */
+  inline const double* get_cell(const ForecastCursor& cursor) const {
+    return &values[cursor.row][cursor.column * num_channels];
+  }
+
+  /** @brief Load another csv as a new channel of this table
+   *
+   * The csv must have exactly the same coordinates and timestamps, so the existing row and column
+   * searches serve it too.
+   *
+   * @param channel_name: Name to look the channel up by, e.g. WIND_EAST_CHANNEL
+   * @param path: Path to the csv
+   *
+   * @return Index of the new channel
+   */
+  size_t add_channel(const std::string& channel_name, const std::string& path);
+
+  /* Index of a channel, or get_num_channels() if the table has no channel of that name */
+  size_t find_channel(const std::string& channel_name) const;
+
+  /* Dimensions of the table. Columns are timestamps, each holding get_num_channels() values */
+  inline size_t get_num_rows() const { return num_rows; }
+  inline size_t get_num_cols() const { return num_cols; }
+  inline size_t get_num_channels() const { return num_channels; }
+
+  /* Path of the csv loaded as channel 0 */
+  inline const std::filesystem::path& get_path() const { return lut_path; }
+
+  /* Smallest and largest value of a channel over the whole table */
+  std::pair<double, double> get_channel_range(size_t channel) const;
+
+  /* Unix time of a column */
+  inline time_t get_column_time(size_t column) const { return forecast_times[column]; }
+
+  /* Coordinate of a row */
+  inline const ForecastCoord& get_row_coord(size_t row) const { return forecast_coords[row]; }
+
   /* Caches for faster accessing */
   int row_cache;
   int column_cache;
@@ -76,12 +159,448 @@ class ForecastLut : public BaseLut<double>{
   /* Initialize the cache variables */
   void initialize_caches(ForecastCoord coord, time_t time);
   void initialize_caches(Coord coord, time_t time);
+
+  /** @brief Integral of a row's channel 0 values over a time interval, in value-seconds
+   *
+   * Each column holds its value over the times closest to it, i.e. the same cells that get_value
+   * picks, so this is the exact integral of what stepping get_value would see with an infinitely
+   * small step. O(log columns) for any interval length.
+   *
+   * @param row: Row to integrate
+   * @param start: Start of the interval as unix time in seconds
+   * @param end: End of the interval as unix time in seconds
+   */
+  double get_integral(size_t row, double start, double end) const;
+
+  /** @brief Upper bound on the integral of channel 0 of any row over a time interval, in value-seconds
+   *
+   * Integrates the largest value of each column and its neighbours, so it also bounds a value
+   * sampled once and held for up to one column spacing, whichever row it was taken from.
+   */
+  double get_upper_bound_integral(double start, double end) const;
+
+  /** @brief Copy of an irradiance table projected onto a flat, horizontal solar array
+   *
+   * Scales channel 0 of every cell by the cosine of the sun's angle from the array normal, which is zero once the
+   * sun is below the horizon. Lookups and integrals on the copy then include the incidence correction
+   * at no extra cost.
+   *
+   * @param sun: Sun geometry built from this table
+   */
+  ForecastLut with_incidence(const SunGeometryLut& sun) const;
+
+ private:
+  /* Times halfway between consecutive columns. Column c covers (boundaries[c-1], boundaries[c]] */
+  std::vector<double> column_boundaries;
+
+  /* Running integral of each row up to the start of each column. The first column starts at its
+   * own timestamp and extends backwards from there */
+  std::vector<std::vector<double>> row_integrals;
+
+  /* Largest value of each column and its neighbours, with its running integral */
+  std::vector<double> column_envelope;
+  std::vector<double> envelope_integral;
+
+  /* Fill in the running integrals once the table is loaded */
+  void precompute_integrals();
+
+  /* Column whose cell contains a time */
+  size_t column_cell(double time) const;
+
+  /* Integral from the first column's timestamp to a time of a row with the given running integrals.
+   * Column c of the row is row[c * stride] */
+  double integral_to(const double* row, size_t stride, const std::vector<double>& integrals, double time) const;
+};
+
+/* Position of the sun in the sky */
+struct SunPosition {
+  double azimuth = 0.0;    // Degrees clockwise from north
+  double elevation = 0.0;  // Degrees above the horizon
+  /* Unit vector towards the sun in local east, north, up coordinates */
+  double east = 0.0;
+  double north = 0.0;
+  double up = 0.0;
+};
+
+/* Sun position at every cell of a forecast table, i.e. at each forecast coordinate and timestamp.
+ * Built once per forecast, so the simulator never has to call get_az_el */
+class SunGeometryLut {
+ private:
+  /* Positions stored row major, one row per forecast coordinate */
+  std::vector<SunPosition> positions;
+
+  size_t num_rows = 0;
+  size_t num_cols = 0;
+
+ public:
+  /** @brief Compute the sun position for each cell of a forecast
+   *
+   * @param forecast: Forecast whose coordinates and timestamps index the table
+   * @param num_threads: Number of threads to split the rows over. 0 uses one per hardware thread
+   */
+  explicit SunGeometryLut(const ForecastLut& forecast, unsigned num_threads = 0);
+
+  /* Empty default constructor */
+  SunGeometryLut() {}
+
+  inline const SunPosition& get_position(size_t row, size_t column) const {
+    return positions[row * num_cols + column];
+  }
+
+  /* Cosine of the angle between the sun and the normal of a flat, horizontal array. Zero when the
+   * sun is below the horizon */
+  inline double get_flat_incidence(size_t row, size_t column) const {
+    return std::max(0.0, get_position(row, column).up);
+  }
+
+  inline size_t get_num_rows() const { return num_rows; }
+  inline size_t get_num_cols() const { return num_cols; }
+};
+
+/* Sunrise and sunset as unix times. The sun is above the horizon from sunrise up to, but not including,
+ * sunset. Both are equal on a day the sun never rises */
+struct DaylightWindow {
+  time_t sunrise = 0;
+  time_t sunset = 0;
+};
+
+/* Daylight window of every forecast coordinate for each local solar day around the forecast's span.
+ * Solar days run from one local mean solar midnight to the next, so outside the polar regions each
+ * holds exactly one window, found by bisecting the sun's elevation to the second with the same solar
+ * model as SunGeometryLut. Looking up the window of a time is O(1) */
+class DaylightLut {
+ private:
+  /* Windows stored row major, num_days per forecast coordinate */
+  std::vector<DaylightWindow> windows;
+
+  /* Unix time at which day 0 of each row starts, i.e. its local mean solar midnight */
+  std::vector<time_t> first_midnight;
+
+  size_t num_rows = 0;
+  size_t num_days = 0;
+
+  /* Day of a row containing a time. Times outside the table use its first or last day */
+  inline size_t day_index(size_t row, double time) const {
+    const double day = std::floor((time - static_cast<double>(first_midnight[row])) / SECONDS_PER_DAY);
+    return static_cast<size_t>(std::clamp(day, 0.0, static_cast<double>(num_days - 1)));
+  }
+
+ public:
+  /** @brief Find the sunrise and sunset of each forecast coordinate on every day from the one before
+   * the first timestamp to the one after the last
+   *
+   * @param forecast: Forecast whose coordinates and timestamps index the table
+   * @param num_threads: Number of threads to split the rows over. 0 uses one per hardware thread
+   */
+  explicit DaylightLut(const ForecastLut& forecast, unsigned num_threads = 0);
+
+  /* Empty default constructor */
+  DaylightLut() {}
+
+  /* Daylight window of the solar day containing a unix time */
+  inline const DaylightWindow& get_window(size_t row, double time) const {
+    return windows[row * num_days + day_index(row, time)];
+  }
+
+  /* True if the sun is above the horizon at a unix time */
+  inline bool is_daylight(size_t row, double time) const {
+    const DaylightWindow& window = get_window(row, time);
+    return time >= static_cast<double>(window.sunrise) && time < static_cast<double>(window.sunset);
+  }
+
+  /** @brief Call visit(from, to) for each stretch of daylight within [start, end), in time order
+   *
+   * An empty table has no notion of night, so the whole interval is visited
+   */
+  template <typename Visitor>
+  void for_each_daylight(size_t row, double start, double end, Visitor&& visit) const {
+    if (num_days == 0) {
+      if (start < end) visit(start, end);
+      return;
+    }
+    const size_t last_day = day_index(row, end);
+    for (size_t day = day_index(row, start); day <= last_day; day++) {
+      const DaylightWindow& window = windows[row * num_days + day];
+      const double from = std::max(start, static_cast<double>(window.sunrise));
+      const double to = std::min(end, static_cast<double>(window.sunset));
+      if (from < to) visit(from, to);
+    }
+  }
+
+  inline size_t get_num_rows() const { return num_rows; }
+  inline size_t get_num_days() const { return num_days; }
+};
+
+/* Sun direction over a region and span of time, cheap enough to look up at every simulation step.
+ *
+ * Nodes lie on a regular grid of time_step seconds by grid_spacing degrees of latitude and longitude, and
+ * hold the unit vector towards the sun in local east, north, up coordinates. Lookups interpolate the vector
+ * trilinearly and normalize it, which stays smooth near the zenith where the azimuth does not. Over the
+ * forecast region with the default 1 minute by 1 degree grid, the interpolated direction is within 0.0011
+ * degrees of get_az_el's: the elevation is within 0.0011 degrees, the azimuth within 0.0011 / cos(elevation).
+ * The error grows with the square of the spacing, e.g. 0.0044 degrees on a 2 degree grid. Lookups outside
+ * the grid use its nearest edge.
+ *
+ * Nodes are stored time major, so one lookup reads two small blocks of the table */
+class SolarPositionLut {
+ private:
+  /* Axes of the grid. Node (t, i, j) is at start_time + t * time_step, min_lat + i * grid_spacing and
+   * min_lon + j * grid_spacing */
+  time_t start_time = 0;
+  time_t time_step = 0;
+  double min_lat = 0.0;
+  double min_lon = 0.0;
+  double grid_spacing = 0.0;
+  size_t num_times = 0;
+  size_t num_lats = 0;
+  size_t num_lons = 0;
+
+  /* Nodes per second and per degree */
+  double time_scale = 0.0;
+  double grid_scale = 0.0;
+
+  /* East, north and up of node (t, i, j) at directions[3 * ((t * num_lats + i) * num_lons + j)] */
+  std::vector<float> directions;
+
+  /* Grid covering a forecast's coordinates and timestamps, without the nodes */
+  void set_domain(const ForecastLut& forecast, double spacing, time_t step);
+
+  /* Compute every node, splitting the grid's coordinates over threads */
+  void fill(unsigned num_threads);
+
+  /* Binary file access. Return false instead of throwing, so the cache can fall back to building */
+  bool read(const std::filesystem::path& path);
+  bool write(const std::filesystem::path& path) const;
+
+  /* Unnormalized direction at a coordinate and unix time */
+  inline void interpolate(double lat, double lon, double time, double* direction) const {
+    const double x = std::clamp((time - static_cast<double>(start_time)) * time_scale, 0.0, num_times - 1.0);
+    const double y = std::clamp((lat - min_lat) * grid_scale, 0.0, num_lats - 1.0);
+    const double z = std::clamp((lon - min_lon) * grid_scale, 0.0, num_lons - 1.0);
+    const size_t t = std::min(static_cast<size_t>(x), num_times - 2);
+    const size_t i = std::min(static_cast<size_t>(y), num_lats - 2);
+    const size_t j = std::min(static_cast<size_t>(z), num_lons - 2);
+    const double dt = x - static_cast<double>(t);
+    const double dy = y - static_cast<double>(i);
+    const double dz = z - static_cast<double>(j);
+
+    const size_t lon_stride = 3;
+    const size_t lat_stride = 3 * num_lons;
+    const size_t time_stride = 3 * num_lats * num_lons;
+    const float* node = &directions[3 * ((t * num_lats + i) * num_lons + j)];
+    for (size_t c = 0; c < 3; c++) {
+      const float* n = node + c;
+      const double before = (n[0] + (n[lon_stride] - n[0]) * dz) * (1.0 - dy) +
+                            (n[lat_stride] + (n[lat_stride + lon_stride] - n[lat_stride]) * dz) * dy;
+      n += time_stride;
+      const double after = (n[0] + (n[lon_stride] - n[0]) * dz) * (1.0 - dy) +
+                           (n[lat_stride] + (n[lat_stride + lon_stride] - n[lat_stride]) * dz) * dy;
+      direction[c] = before + (after - before) * dt;
+    }
+  }
+
+ public:
+  static constexpr double DEFAULT_GRID_SPACING = 1.0;  // Degrees
+  static constexpr time_t DEFAULT_TIME_STEP = 60;      // Seconds
+
+  /** @brief Compute the sun direction over the smallest grid covering a forecast's coordinates and timestamps
+   *
+   * @param forecast: Forecast whose coordinates and timestamps set the region and span of time
+   * @param spacing: Grid spacing in degrees of latitude and longitude
+   * @param step: Time between nodes in seconds
+   * @param num_threads: Number of threads to split the grid over. 0 uses one per hardware thread
+   */
+  explicit SolarPositionLut(const ForecastLut& forecast, double spacing = DEFAULT_GRID_SPACING,
+                            time_t step = DEFAULT_TIME_STEP, unsigned num_threads = 0);
+
+  /* Load a table written by save */
+  explicit SolarPositionLut(const std::filesystem::path& path);
+
+  /* Empty default constructor */
+  SolarPositionLut() {}
+
+  /* Write the table to a binary file in native byte order, to be read back on the same kind of machine */
+  void save(const std::filesystem::path& path) const;
+
+  /* True if another table has the same region, span and spacing, whatever its nodes hold */
+  bool same_domain(const SolarPositionLut& other) const;
+
+  /* Cache file kept next to a forecast csv */
+  static std::filesystem::path cache_path(const std::filesystem::path& forecast_path);
+
+  /** @brief Table for a forecast, read from its cache file if that holds the same grid
+   *
+   * Otherwise the table is built and written to the cache file for next time. A cache file that cannot
+   * be written only costs the rebuild on the next call
+   */
+  static SolarPositionLut cached(const ForecastLut& forecast, double spacing = DEFAULT_GRID_SPACING,
+                                 time_t step = DEFAULT_TIME_STEP, unsigned num_threads = 0);
+
+  /* Sun position at a coordinate and unix time */
+  SunPosition get_position(double lat, double lon, double time) const;
+
+  /* Cosine of the angle between the sun and the normal of a flat, horizontal array. Zero when the
+   * sun is below the horizon */
+  inline double get_flat_incidence(double lat, double lon, double time) const {
+    double direction[3];
+    interpolate(lat, lon, time, direction);
+    const double length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] +
+                                    direction[2] * direction[2]);
+    return std::max(0.0, direction[2] / length);
+  }
+
+  inline size_t get_num_times() const { return num_times; }
+  inline size_t get_num_lats() const { return num_lats; }
+  inline size_t get_num_lons() const { return num_lons; }
+};
+
+/* Battery behaviour as a function of state of charge, for O(1) lookups in the simulation loop.
+ *
+ * Read from a csv with the header soc,charge_efficiency,discharge_efficiency,internal_resistance,open_circuit_voltage
+ * and one row per state of charge, evenly spaced from 0 to 1. Row i of the table holds, at the i-th state
+ * of charge, the charge efficiency, the inverse discharge efficiency and the resistive loss factor
+ * R / V^2 (1/W), followed by the slope of each to the next row. A lookup is then one index computation
+ * and three multiply-adds */
+class BatteryLut : public BaseLut<double> {
+ private:
+  /* Columns of a row */
+  static constexpr size_t CHARGE_EFFICIENCY = 0;
+  static constexpr size_t INVERSE_DISCHARGE_EFFICIENCY = 1;
+  static constexpr size_t RESISTANCE_FACTOR = 2;
+  static constexpr size_t NUM_QUANTITIES = 3;
+
+  /* Rows per unit state of charge, i.e. num_rows - 1 */
+  double soc_scale = 0.0;
+
+  void load_LUT() override;
+
+ public:
+  /* Load a csv upon construction */
+  explicit BatteryLut(const std::string path);
+
+  /* Empty default constructor */
+  BatteryLut() {}
+
+  /** @brief Rate of change of the stored energy (W) for a given power at the battery terminals
+   *
+   * Charging stores the terminal power times the charge efficiency. Discharging draws the terminal
+   * power over the discharge efficiency. Either way, the resistive loss R I^2 = R / V^2 * P^2 comes on top.
+   *
+   * @param terminal_power: Power into the battery (W). Negative when discharging
+   * @param soc: State of charge (0-1), clamped to the table
+   */
+  inline double stored_power(double terminal_power, double soc) const {
+    const double position = std::clamp(soc, 0.0, 1.0) * soc_scale;
+    const size_t row = std::min(static_cast<size_t>(position), num_rows - 2);
+    const double offset = position - static_cast<double>(row);
+    const std::vector<double>& cell = values[row];
+    const double charge = cell[CHARGE_EFFICIENCY] + cell[NUM_QUANTITIES + CHARGE_EFFICIENCY] * offset;
+    const double discharge = cell[INVERSE_DISCHARGE_EFFICIENCY] + cell[NUM_QUANTITIES + INVERSE_DISCHARGE_EFFICIENCY] * offset;
+    const double resistance = cell[RESISTANCE_FACTOR] + cell[NUM_QUANTITIES + RESISTANCE_FACTOR] * offset;
+    return terminal_power * (terminal_power > 0 ? charge : discharge) - resistance * terminal_power * terminal_power;
+  }
+};
+
+/* Motor efficiency along the torque axis at one fixed speed, cut from a MotorLut */
+struct MotorSlice {
+  /* Per torque cell, the efficiency at the cell start and its slope across the cell */
+  std::vector<double> coefficients;
+  double torque_min = 0.0;
+  double torque_scale = 0.0;  // Cells per N m
+  size_t last_cell = 0;       // Index of the last cell
+
+  /* Efficiency at a torque (N m). Regenerative torque looks up its magnitude. Branch free */
+  inline double get_efficiency(double torque) const {
+    const double y = std::clamp((std::abs(torque) - torque_min) * torque_scale, 0.0, last_cell + 1.0);
+    const size_t cell = std::min(static_cast<size_t>(y), last_cell);
+    const double* c = &coefficients[2 * cell];
+    return c[0] + c[1] * (y - static_cast<double>(cell));
+  }
+};
+
+/* Motor efficiency map over motor speed and torque, with bilinear interpolation.
+ *
+ * Read from a csv whose header row is a label followed by the torque breakpoints (N m), and whose
+ * other rows are a motor speed (rpm) followed by the efficiencies at each torque. Both axes must be
+ * evenly spaced. Each cell of the table stores its bilinear coefficients, so that with dx, dy the
+ * offsets into the cell, efficiency = c0 + c1 dx + c2 dy + c3 dx dy. Cell (i, j) spans speed rows i, i+1
+ * and torque columns j, j+1, and is stored at values[i][4j .. 4j+3] */
+class MotorLut : public BaseLut<double> {
+ private:
+  double speed_min = 0.0;
+  double speed_scale = 0.0;   // Cells per rpm
+  double torque_min = 0.0;
+  double torque_scale = 0.0;  // Cells per N m
+  /* Index of the last cell on each axis */
+  size_t last_speed_cell = 0;
+  size_t last_torque_cell = 0;
+
+  /* Highest efficiency anywhere in the map */
+  double max_efficiency = 0.0;
+
+  void load_LUT() override;
+
+ public:
+  /* Load a csv upon construction */
+  explicit MotorLut(const std::string path);
+
+  /* Empty default constructor */
+  MotorLut() {}
+
+  /* Efficiency at a motor speed (rpm) and torque (N m), clamped to the map. Regenerative torque
+   * looks up its magnitude. Branch free */
+  inline double get_efficiency(double speed, double torque) const {
+    const double x = std::clamp((speed - speed_min) * speed_scale, 0.0, last_speed_cell + 1.0);
+    const double y = std::clamp((std::abs(torque) - torque_min) * torque_scale, 0.0, last_torque_cell + 1.0);
+    const size_t row = std::min(static_cast<size_t>(x), last_speed_cell);
+    const size_t col = std::min(static_cast<size_t>(y), last_torque_cell);
+    const double dx = x - static_cast<double>(row);
+    const double dy = y - static_cast<double>(col);
+    const double* c = &values[row][4 * col];
+    return c[0] + c[1] * dx + c[2] * dy + c[3] * dx * dy;
+  }
+
+  /* The map at one motor speed (rpm), for when the speed stays constant, e.g. over a whole run */
+  MotorSlice slice(double speed) const;
+
+  inline double get_max_efficiency() const { return max_efficiency; }
+};
+
+/* Horizontal direction of travel as a unit vector in local east, north coordinates */
+struct Heading {
+  double east = 0.0;
+  double north = 0.0;
 };
 
 class Route {
  private:
   /* Points of the route */
   std::vector<Coord> route_points;
+
+  /* Per segment geometry. Segment i runs from route_points[i] to route_points[i+1] */
+  std::vector<double> segment_distances;
+  std::vector<double> segment_angles;
+  std::vector<Heading> segment_headings;
+
+  /* Prefix sums over segments. Element i covers route_points[0] up to route_points[i] */
+  std::vector<double> cumulative_distances;
+  std::vector<double> cumulative_climbs;
+
+  /* Uniform lat/lon grid over the route for nearest point queries. The points of cell
+   * (row, col) are grid_points[grid_cell_starts[c] .. grid_cell_starts[c+1]) with c = row * grid_cols + col */
+  double grid_min_lat = 0.0;
+  double grid_min_lon = 0.0;
+  size_t grid_rows = 0;
+  size_t grid_cols = 0;
+  std::vector<size_t> grid_cell_starts;
+  std::vector<size_t> grid_points;
+
+  /* Fill in the segment geometry and prefix sums from the route points */
+  void precompute_segments();
+
+  /* Bucket the route points into the nearest point grid */
+  void build_grid();
+
  public:
   /* Read a CSV with columns |latitude|longitude|altitude(m)| */
   explicit Route(const std::string route_path);
@@ -89,5 +608,31 @@ class Route {
   /* Empty default constructor */
   Route() {}
 
-  inline std::vector<Coord> get_route_points() const { return route_points; }
+  inline const std::vector<Coord>& get_route_points() const { return route_points; }
+
+  /* Length (m) and incline (rad) of the segment starting at route point idx */
+  inline double get_segment_distance(size_t idx) const { return segment_distances[idx]; }
+  inline double get_segment_angle(size_t idx) const { return segment_angles[idx]; }
+
+  /* Direction of travel along the segment starting at route point idx. Zero for a zero length segment */
+  inline const Heading& get_segment_heading(size_t idx) const { return segment_headings[idx]; }
+
+  /** @brief Index of the route point closest to a coordinate, by great circle distance
+   * Only searches the grid cells around the coordinate, so it is cheap enough for live use
+   */
+  size_t find_nearest_point(const Coord& coord) const;
+
+  /* Sums over the segments from route point `from` up to route point `to`, in O(1) */
+  inline RouteAggregate get_aggregate(size_t from, size_t to) const {
+    RouteAggregate aggregate;
+    aggregate.distance = cumulative_distances[to] - cumulative_distances[from];
+    aggregate.climb = cumulative_climbs[to] - cumulative_climbs[from];
+    aggregate.segments = to - from;
+    return aggregate;
+  }
+
+  /* Sums over the segments from route point idx to the end of the route */
+  inline RouteAggregate get_remaining_aggregate(size_t idx) const {
+    return get_aggregate(idx, route_points.size() - 1);
+  }
 };
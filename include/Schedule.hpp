@@ -0,0 +1,134 @@
+/* Driving schedules: the windows of local time in which the car may drive, and a cursor that answers
+   schedule queries cheaply as simulation time moves forward
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <limits>
+#include <vector>
+
+#include "CustomTime.hpp"
+
+/* Driving is allowed from start up to, but not including, end */
+struct DrivingWindow {
+  EpochTime start;
+  EpochTime end;
+};
+
+/* Driving windows over any number of days, in time order. The race ends with the last window */
+class DrivingSchedule {
+ private:
+  std::vector<DrivingWindow> windows;
+
+  /* Driving seconds from the start of each window to the end of the schedule, with a trailing 0 */
+  std::vector<double> driving_time_from_window;
+
+  friend class ScheduleCursor;
+
+ public:
+  /* Empty schedule, in which driving is never allowed */
+  DrivingSchedule() {}
+
+  /** @brief Schedule from a list of windows
+   *
+   * @param windows: Windows in time order. They may touch but not overlap. Empty windows are dropped
+   */
+  explicit DrivingSchedule(std::vector<DrivingWindow> windows);
+
+  /** @brief Schedule with the same driving hours every day after the first, as in most solar races
+   *
+   * @param first_start: Start of driving on the first day
+   * @param first_end: End of driving on the first day
+   * @param day_start: Start of driving on later days in seconds since local midnight
+   * @param day_end: End of driving on later days in seconds since local midnight
+   * @param race_end: End of the race. Windows are cut off there
+   */
+  static DrivingSchedule daily(const EpochTime& first_start, const EpochTime& first_end, int64_t day_start,
+                               int64_t day_end, const EpochTime& race_end);
+
+  inline const std::vector<DrivingWindow>& get_windows() const { return windows; }
+  inline bool empty() const { return windows.empty(); }
+
+  /* Start of the first window and end of the last. The schedule must not be empty */
+  inline const EpochTime& get_start() const { return windows.front().start; }
+  inline const EpochTime& get_end() const { return windows.back().end; }
+
+  /* Driving seconds left from a time to the end of the schedule. O(log windows) for any time */
+  double driving_time_left(const EpochTime& time) const;
+};
+
+/* Position in a DrivingSchedule for a time that only moves forward, as in a simulation.
+ *
+ * The window boundaries start_0, end_0, start_1, end_1, ... split time into stretches that alternate
+ * between not driving and driving. The cursor remembers the stretch of the last time it saw and the
+ * boundary ending it, so while time stays before that boundary each query is a single comparison.
+ * Crossing a boundary walks forward to the stretch of the new time. Times must not go backwards; reset
+ * the cursor to jump back */
+class ScheduleCursor {
+ private:
+  static constexpr int64_t NO_BOUNDARY = std::numeric_limits<int64_t>::max();
+
+  const DrivingSchedule* schedule = nullptr;
+
+  /* Number of boundaries at or before the current time. Odd while driving */
+  size_t boundary = 0;
+
+  /* Local milliseconds of the boundary ending the current stretch, or NO_BOUNDARY after the last */
+  int64_t next_boundary_ms = NO_BOUNDARY;
+
+  /* Local milliseconds of a boundary, or NO_BOUNDARY past the last one */
+  int64_t boundary_ms(size_t index) const;
+
+  /* Step past every boundary at or before a time */
+  void walk(int64_t time_ms);
+
+  inline int64_t update(const EpochTime& time) {
+    const int64_t time_ms = time.get_local_milliseconds();
+    if (time_ms >= next_boundary_ms) walk(time_ms);
+    return time_ms;
+  }
+
+ public:
+  /* Cursor over an empty schedule */
+  ScheduleCursor() {}
+
+  /** @brief Cursor placed at a time
+   *
+   * @param schedule: Schedule to query. Must outlive the cursor
+   * @param time: Time to start from
+   */
+  ScheduleCursor(const DrivingSchedule& schedule, const EpochTime& time);
+
+  /* Place the cursor at any time, including one before the last query. O(log windows) */
+  void reset(const EpochTime& time);
+
+  /* True if driving is allowed at a time */
+  inline bool is_driving(const EpochTime& time) {
+    update(time);
+    return boundary % 2 == 1;
+  }
+
+  /* Seconds from a time to the end of its driving window. 0 when driving is not allowed */
+  inline double time_left_in_window(const EpochTime& time) {
+    const int64_t time_ms = update(time);
+    return boundary % 2 == 1 ? static_cast<double>(next_boundary_ms - time_ms) / 1000.0 : 0.0;
+  }
+
+  /* Seconds from a time to the start of the next driving window. 0 while driving, infinity after the
+   * last window */
+  inline double time_until_start(const EpochTime& time) {
+    const int64_t time_ms = update(time);
+    if (boundary % 2 == 1) return 0.0;
+    if (next_boundary_ms == NO_BOUNDARY) return std::numeric_limits<double>::infinity();
+    return static_cast<double>(next_boundary_ms - time_ms) / 1000.0;
+  }
+
+  /* Driving seconds left from a time to the end of the schedule */
+  inline double driving_time_left(const EpochTime& time) {
+    const int64_t time_ms = update(time);
+    const size_t window = boundary / 2;
+    if (boundary % 2 == 0) return schedule ? schedule->driving_time_from_window[window] : 0.0;
+    return static_cast<double>(next_boundary_ms - time_ms) / 1000.0 + schedule->driving_time_from_window[window + 1];
+  }
+};
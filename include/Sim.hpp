@@ -5,19 +5,180 @@ Class to run the a full scale simulation on a WSC type route
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <array>
 #include <string>
 #include <memory>
 #include <vector>
+#include <unordered_set>
 
 #include "CustomTime.hpp"
 #include "Car.hpp"
 #include "Luts.hpp"
+#include "Schedule.hpp"
 
-class Simulator {
+/* Reason a simulation run was judged not viable */
+enum class SimFailure {
+  None,      // The car reached the finish line in time with energy to spare
+  Deadline,  // The car could not reach the finish line before the race end time
+  Energy     // The battery energy dropped below zero
+};
+
+/* Readable name of a failure reason, e.g. for console or log output */
+const char* sim_failure_name(SimFailure failure);
+
+/* Outcome of a single simulation run. The simulator never prints; callers decide what to report */
+struct SimResult {
+  /* True if the speed is viable */
+  bool feasible = false;
+  /* Why the run is not viable. SimFailure::None when feasible */
+  SimFailure failure = SimFailure::None;
+
+  /* Time at which the run ended, either at the finish line or where it was abandoned */
+  EpochTime finish_time;
+  /* Race time in seconds, from the start of the first driving window to finish_time */
+  double elapsed_seconds = 0.0;
+
+  /* Lowest battery energy (J) and state of charge (0-1) seen during the run */
+  double min_battery_energy = 0.0;
+  double min_soc = 0.0;
+  /* Route index and time at which the minimum state of charge occurred */
+  size_t min_soc_index = 0;
+  EpochTime min_soc_time;
+
+  /* Energy totals in Joules */
+  double final_battery_energy = 0.0;
+  // Energy drawn by the motor and electronics while driving
+  double drive_energy = 0.0;
+  // Solar energy delivered to the battery, both while driving and while stationary
+  double solar_energy = 0.0;
+  // Solar energy thrown away because the battery was already full
+  double clipped_energy = 0.0;
+};
+
+/* Small direct mapped memo of the car's power for the inputs of a driving step. Slots are picked by
+ * a hash of the quantized inputs, and a hit needs the exact inputs, so a cached power is always
+ * exactly what the car would compute */
+class PowerCache {
+ public:
+  /* Inputs of one evaluation of the car's power */
+  struct Key {
+    double speed = 0.0;
+    double angle = 0.0;
+    double irradiance = 0.0;
+    double headwind = 0.0;
+    double density_ratio = 0.0;
+
+    inline bool operator==(const Key& other) const {
+      return speed == other.speed && angle == other.angle && irradiance == other.irradiance &&
+             headwind == other.headwind && density_ratio == other.density_ratio;
+    }
+  };
+
+  /* The cached power for a key, or compute() stored in the key's slot */
+  template <typename Compute>
+  inline double get(const Key& key, Compute&& compute) {
+    Slot& slot = slots[slot_index(key)];
+    if (slot.valid && slot.key == key) {
+      hits++;
+      return slot.power;
+    }
+    misses++;
+    slot.key = key;
+    slot.power = compute();
+    slot.valid = true;
+    return slot.power;
+  }
+
+  /* Forget every cached power, e.g. when the car changes. Keeps the statistics */
+  void clear();
+
+  /* Lookup statistics since construction or the last reset_stats */
+  inline uint64_t get_hits() const { return hits; }
+  inline uint64_t get_misses() const { return misses; }
+  inline double get_hit_rate() const { return (hits + misses) ? static_cast<double>(hits) / (hits + misses) : 0.0; }
+  inline void reset_stats() { hits = misses = 0; }
+
+ private:
+  /* Number of slots, a power of two */
+  static constexpr size_t NUM_SLOTS = 256;
+
+  struct Slot {
+    Key key;
+    double power = 0.0;
+    bool valid = false;
+  };
+  std::array<Slot, NUM_SLOTS> slots{};
+
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  /* Multiplicative hash of the inputs quantized to mm/s, microradians, 0.1 W/m^2, mm/s and 1e-6 */
+  static inline size_t slot_index(const Key& key) {
+    uint64_t hash = static_cast<uint64_t>(static_cast<int64_t>(key.speed * 1e3)) * 0x9E3779B97F4A7C15ull;
+    hash ^= static_cast<uint64_t>(static_cast<int64_t>(key.angle * 1e6)) * 0xC2B2AE3D27D4EB4Full;
+    hash ^= static_cast<uint64_t>(static_cast<int64_t>(key.irradiance * 1e1)) * 0x165667B19E3779F9ull;
+    hash ^= static_cast<uint64_t>(static_cast<int64_t>(key.headwind * 1e3)) * 0x27D4EB2F165667C5ull;
+    hash ^= static_cast<uint64_t>(static_cast<int64_t>(key.density_ratio * 1e6)) * 0x85EBCA77C2B2AE63ull;
+    return static_cast<size_t>(hash >> 56) & (NUM_SLOTS - 1);
+  }
+};
+
+/* Compact snapshot of a run, taken at each control stop and overnight stop before the stop is
+ * served. Holds everything needed to carry on the run from that point */
+struct SimCheckpoint {
+  /* Route point the car is at, or driving away from */
+  size_t route_index = 0;
+  /* Distance (m) still to drive on the segment starting at route_index */
+  double segment_distance_left = 0.0;
+  /* True if the car is at a control stop it has not served yet */
+  bool control_stop_pending = false;
+  /* Simulation clock */
+  EpochTime time;
+  /* Battery energy (J) */
+  double battery_energy = 0.0;
+  /* Forecast lookup position. Every lookup before this checkpoint used this column or an earlier one */
+  ForecastCursor cursor;
+  /* Statistics accumulated up to this point */
+  SimResult progress;
+};
+
+/* A forecast and the tables the simulator derives from it. Deriving them takes a while, so build them once
+ * with make_forecast_tables and hand the same tables to every simulator that races on the forecast */
+struct ForecastTables {
+  std::shared_ptr<const ForecastLut> forecast;
+  // Sun position at each forecast cell, and the forecast projected onto the car's flat array with it
+  std::shared_ptr<const SunGeometryLut> sun_geometry;
+  std::shared_ptr<const ForecastLut> array_irradiance;
+  // Sunrise and sunset at each forecast coordinate. The car only charges while stationary in daylight
+  std::shared_ptr<const DaylightLut> daylight;
+};
+
+/* Derive the simulator's tables from a forecast */
+ForecastTables make_forecast_tables(std::shared_ptr<const ForecastLut> forecast);
+
+/* Simulator for a given car type. The car's energy model is inlined into the simulation loop,
+ * so a StaticCar gets its parameters folded in as constants */
+template <typename CarType>
+class BasicSimulator {
  private:
-  // Lookup tables
-  Route route;
-  ForecastLut forecast_lut;
+  // Lookup tables. Read only once set, so copies of a simulator share them. See ForecastTables
+  std::shared_ptr<const Route> route;
+  std::shared_ptr<const ForecastLut> forecast_lut;
+  std::shared_ptr<const SunGeometryLut> sun_geometry;
+  std::shared_ptr<const ForecastLut> array_irradiance;
+  std::shared_ptr<const DaylightLut> daylight;
+
+  // Weather channels of the forecast, used when the forecast has them
+  bool has_wind = false;
+  size_t wind_east_channel = 0;
+  size_t wind_north_channel = 0;
+  bool has_temperature = false;
+  size_t temperature_channel = 0;
+  // Bound on the wind speed and range of relative air density over the forecast, for pruning
+  double max_wind_speed = 0.0;
+  double min_density_ratio = 1.0;
+  double max_density_ratio = 1.0;
 
   // Control stops
   std::unordered_set<size_t> control_stops;
@@ -31,25 +192,57 @@ class Simulator {
   // For each timestamp, we track the UTC offset. For the location of the race (Australia),
   // it is 9.5 hours ahead of UTC
   // Day one start time in 24 hour local time
-  const Time day_one_start_time = Time("2023-10-22 10:00:00", -9.5);
+  static constexpr EpochTime day_one_start_time = EpochTime::from_civil(2023, 10, 22, 10, 0, 0, -9.5);
   // Day one end time in 24 hour local time
-  const Time day_one_end_time = Time("2023-10-22 18:00:00", -9.5);
-  // Start time from day 2 onwards in 24 hour local time
-  const Time day_start_time = Time("09:00:00");
-  // End time from day 2 onwards in 24 hour local time
-  const Time day_end_time = Time("17:00:00");
+  static constexpr EpochTime day_one_end_time = EpochTime::from_civil(2023, 10, 22, 18, 0, 0, -9.5);
+  // Start time from day 2 onwards in seconds since local midnight
+  static constexpr int64_t day_start_time = time_of_day(9, 0, 0);
+  // End time from day 2 onwards in seconds since local midnight
+  static constexpr int64_t day_end_time = time_of_day(17, 0, 0);
   // End time of the entire race in 24 hour local time
-  const Time race_end_time = Time("2023-10-28 17:00:00", -9.5);
+  static constexpr EpochTime race_end_time = EpochTime::from_civil(2023, 10, 28, 17, 0, 0, -9.5);
   // NO TOUCH
   /* ---------------------- Simulation parameters ------------------------- */
 
+  // Usable battery capacity in Joules (5.2 kWh)
+  const double battery_capacity = 5.2 * 3600 * 1000;
+
   // Starting coordinate of the car
   Coord starting_coord;
   // Starting time of the simulation
-  Time curr_time;
+  EpochTime starting_time;
+  // State of charge (0-1) at the start of the simulation
+  double starting_soc = 1.0;
 
   /* Energy model of the car to simulate on */
-  std::shared_ptr<Car> car;
+  std::shared_ptr<CarType> car;
+
+  /* Windows in which the car may drive. Built from the race day parameters unless set_schedule replaces it */
+  DrivingSchedule schedule;
+
+  /* Closest forecast row to each route point. Shared with copies of this simulator */
+  std::shared_ptr<const std::vector<size_t>> route_forecast_rows;
+
+  /* Checkpoints of the last run in time order */
+  std::vector<SimCheckpoint> checkpoints;
+
+  /* Memo of the car's power over driving steps. Cleared at the start of every run */
+  PowerCache power_cache;
+
+  /* Route aggregates between consecutive control stops, from the start to the finish line */
+  std::vector<RouteAggregate> stretch_aggregates;
+
+  /* Split the route into stretches at the control stops */
+  void build_stretches();
+
+  /* Match each route point with its forecast row once both tables are set */
+  void index_route_forecast();
+
+  /* Find the weather channels of the forecast and their bounds */
+  void index_weather_channels();
+
+  /* Carry a run forward from a state to the end of the route */
+  SimResult simulate(SimCheckpoint state, const double speed);
 
  public:
   /** Construct all simulator objects this way
@@ -57,18 +250,106 @@ class Simulator {
    * @param starting_coord The starting coordinate of the car
    * @param current_time Current starting time of the simulation
   */
-  Simulator(std::shared_ptr<Car> model, Coord starting_coord, Time starting_time);
+  BasicSimulator(std::shared_ptr<CarType> model, Coord starting_coord, EpochTime starting_time);
 
   // Setters
-  inline void set_control_stops(std::unordered_set<size_t> stops) { control_stops = stops; }
-  inline void set_route(Route new_route) { route = new_route; }
-  inline void set_forecast_lut(ForecastLut new_forecast_lut) { forecast_lut = new_forecast_lut; }
+  void set_control_stops(std::unordered_set<size_t> stops);
+  void set_route(Route new_route);
+  void set_forecast_lut(ForecastLut new_forecast_lut);
+  inline void set_car(std::shared_ptr<CarType> model) { car = model; }
+
+  /** @brief Race on a different schedule than the race day parameters, e.g. another event or a rest day
+   *
+   * The race ends with the last window, and elapsed times count from the start of the first.
+   *
+   * @param new_schedule: Driving windows. Must not be empty
+   */
+  void set_schedule(DrivingSchedule new_schedule);
+  inline const DrivingSchedule& get_schedule() const { return schedule; }
 
-  /** @brief Run a full simulation with a car object and a series of route points
+  // Setters that share already loaded tables, e.g. between simulators of different car types
+  void set_route(std::shared_ptr<const Route> new_route);
+  void set_forecast_lut(std::shared_ptr<const ForecastLut> new_forecast_lut);
+  void set_forecast_tables(const ForecastTables& tables);
+
+  /* Tables of the current forecast, to share with other simulators */
+  ForecastTables get_forecast_tables() const;
+
+  /** @brief Move the start of the simulation somewhere into the race, e.g. to replan from live data
+   *
+   * The car starts at the route point closest to the coordinate, so only the remaining distance is
+   * simulated. A control stop at that point is treated as already served.
+   *
+   * @param coord: Current position of the car
+   * @param time: Current time
+   * @param soc: Measured state of charge (0-1)
+   */
+  void set_start(const Coord& coord, const EpochTime& time, const double soc);
+
+  /** @brief Run a simulation with a car object and a series of route points, from the starting
+  * coordinate, time and state of charge to the end of the route
   *
-  * @param speed: The speed in kph
+  * The run stops early once it is provably not viable: when the remaining distance cannot be
+  * covered in the remaining driving time, when the battery goes negative, or when even the
+  * brightest possible sun cannot supply the energy still needed to finish.
+  *
+  * @param speed: The speed in m/s
   * 
-  * @return True if this is a posible
+  * @return Result of the run. result.feasible is true if this is a possible speed
   */
-  bool run_sim(const double speed);
+  SimResult run_sim(const double speed);
+
+  /** @brief Carry on a run from a checkpoint instead of from the start line
+   *
+   * Checkpoints at or after the resumed one are replaced by the ones the resumed run records.
+   * Typical use after a forecast update: set_forecast_lut, invalidate_checkpoints_after, then resume
+   * from the last checkpoint left.
+   *
+   * @param checkpoint: State to resume from, usually one of get_checkpoints()
+   * @param speed: The speed in m/s
+   *
+   * @return Result of the whole run, including what happened before the checkpoint
+   */
+  SimResult resume_sim(const SimCheckpoint& checkpoint, const double speed);
+
+  /** @brief Energy needed to drive each stretch between control stops at a constant speed,
+   * ignoring solar gain. Costs a few multiply-adds per stretch, with no route walk
+   *
+   * @param speed: The speed in m/s
+   */
+  std::vector<double> estimate_stretch_energies(const double speed) const;
+
+  /* Checkpoints recorded by the last run, in time order */
+  inline const std::vector<SimCheckpoint>& get_checkpoints() const { return checkpoints; }
+
+  /* Power memo, for its hit statistics over all runs so far */
+  inline const PowerCache& get_power_cache() const { return power_cache; }
+  inline void reset_power_cache_stats() { power_cache.reset_stats(); }
+
+  /** @brief Drop every checkpoint that depends on forecast data at or after a time
+   *
+   * @param time: Earliest forecast timestamp whose data changed
+   */
+  void invalidate_checkpoints_after(const EpochTime& time);
 };
+
+/* Simulator for cars with runtime parameters */
+using Simulator = BasicSimulator<Car>;
+
+/* Simulator for the production car, with its parameters compiled in */
+using ProductionSimulator = BasicSimulator<ProductionCar>;
+
+/** @brief Sweep several car configurations over the same speeds in parallel
+ *
+ * Each worker thread runs on a copy of base. Copies share the route, the forecast and the
+ * geometry precomputed from them, so those are loaded once for the whole batch.
+ *
+ * @param base: Simulator with the route, forecast, control stops and start already set
+ * @param cars: Car configurations to compare
+ * @param speeds: Speeds to try with every configuration, in m/s
+ * @param num_threads: Number of worker threads. 0 uses one per hardware thread
+ *
+ * @return results[c][s] is the result of cars[c] at speeds[s]
+ */
+std::vector<std::vector<SimResult>> run_car_batch(const Simulator& base, const std::vector<CarParams>& cars,
+                                                  const std::vector<double>& speeds, unsigned num_threads = 0);
@@ -3,6 +3,7 @@
 #include <string>
 #include <ctime>
 #include <iostream>
+#include <span>
 
 #pragma once
 
@@ -30,6 +31,9 @@
 #define MPS_TO_KPH (3.6)
 #define GRAVITY_ACCELERATION (9.81)
 #define KM_TO_M (1000.0)
+#define CELSIUS_TO_KELVIN (273.15)
+#define SECONDS_PER_DAY (86400.0)
+#define UNIX_EPOCH_JULIAN_DAY (2440587.5)
 inline double hours2secs(double hours) { return hours * HOURS_TO_SECONDS; }
 inline double kph2mps(double kph) {return kph / MPS_TO_KPH; }
 
@@ -67,6 +71,30 @@ struct Coord {
   explicit Coord(const struct ForecastCoord& fc) : lat(fc.lat), lon(fc.lon), alt(0.0) {}
 };
 
+/* Vector instruction sets that batch kernels can be dispatched to, from slowest to fastest */
+enum class SimdLevel {
+  Scalar,  // Portable C++, no vector instructions
+  Avx2,    // 4 doubles per instruction
+  Avx512   // 8 doubles per instruction
+};
+
+/* Widest instruction set supported by the CPU running the program. Checked once and cached */
+SimdLevel detect_simd_level();
+
+/* A requested instruction set, lowered to detect_simd_level() if the CPU does not support it. Batch kernels
+ * dispatch on this, so they never run instructions the CPU cannot execute */
+SimdLevel clamp_simd_level(SimdLevel requested);
+
+/* Readable name of an instruction set, e.g. for console or log output */
+const char* simd_level_name(SimdLevel level);
+
+/* Sums over a run of route segments. Enough to price the run at any constant speed */
+struct RouteAggregate {
+  double distance = 0.0;  // Sum of segment distances (m)
+  double climb = 0.0;     // Sum of distance * sin(incline), i.e. net altitude gain (m)
+  size_t segments = 0;    // Number of segments
+};
+
 /* Determine if a string can be represented by a double */
 bool isDouble(std::string str);
 
@@ -86,9 +114,23 @@ double get_distance(Coord src_coord, Coord dst_coord);
  */
 double get_forecast_coord_distance(ForecastCoord src_coord, ForecastCoord dst_coord);
 
+/** @brief Largest real root of the depressed cubic a x^3 + p x + q = 0, in closed form
+ *
+ * Uses Cardano's formula when there is one real root and the trigonometric method when there are
+ * three, then polishes the root with a Newton step.
+ *
+ * @param a: Cubic coefficient, must be positive
+ * @param p: Linear coefficient
+ * @param q: Constant term
+ *
+ * @return The largest root if it is positive, NaN otherwise
+ */
+double largest_cubic_root(double a, double p, double q);
+
 /** @brief Get julian day from a utc time
  * 
- * Note: time_t is the number of seconds since epoch beginning
+ * Note: time_t is the number of seconds since epoch beginning. Pure arithmetic, so the result does
+ * not depend on the host's timezone
  * 
  * @param utc_time_point: UTC time relative to epoch
  */
@@ -134,4 +176,30 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 void get_az_el(time_t utc_time_point, double Lat, double Lon, double Alt, double* Az, double* El);
 
+/** @brief get_az_el for many points at once, using the widest vector instructions the CPU supports
+ *
+ * Follows the same model as get_az_el, but with polynomial sines, cosines and arctangents in place of
+ * libm, and the intermediate angles carried as sine/cosine pairs. Agrees with get_az_el to about 1e-9
+ * degrees.
+ *
+ * @param utc_time_points: UTC times relative to epoch
+ * @param lat: Latitudes in degrees
+ * @param lon: Longitudes in degrees
+ * @param alt: Altitudes, as for get_az_el
+ * @param az: Azimuths in degrees clockwise from north, same length as the inputs
+ * @param el: Elevations in degrees, same length as the inputs
+ * @param level: Instruction set to use. Levels the CPU does not support fall back to scalar
+ */
+void get_az_el_batch(std::span<const time_t> utc_time_points, std::span<const double> lat,
+                     std::span<const double> lon, std::span<const double> alt, std::span<double> az,
+                     std::span<double> el, SimdLevel level = detect_simd_level());
+
+/** @brief get_az_el_batch that also gives the unit vector towards the sun in local east, north, up
+ * coordinates, i.e. (cos(el) sin(az), cos(el) cos(az), sin(el)), without any further trig
+ */
+void get_az_el_batch(std::span<const time_t> utc_time_points, std::span<const double> lat,
+                     std::span<const double> lon, std::span<const double> alt, std::span<double> az,
+                     std::span<double> el, std::span<double> east, std::span<double> north, std::span<double> up,
+                     SimdLevel level = detect_simd_level());
+
 // Define your other utility functions and/or types here
@@ -16,7 +16,8 @@
 #include "Utils.hpp"
 
 int main(int argc, char* argv[]) {
-  RUNTIME_EXCEPTION(argc == 3, "Need base route location and dni csv location. Example ./sim.exe baseroute.csv dni.csv");
+  RUNTIME_EXCEPTION(argc >= 3, "Need base route location and dni csv location. Example ./sim.exe baseroute.csv dni.csv"
+                    " [car1.cfg car2.cfg ...]");
 
   // Control stops - DO NOT TOUCH
   // For each idx in control_stops, the car must stop for 30 minutes at route.get_route_points()[idx]
@@ -24,34 +25,76 @@ int main(int argc, char* argv[]) {
   std::unordered_set<size_t> control_stops = {2962,5559,9462,11421,14439,16990,20832,23202,25987};
 
   // Load base route csv
-  Route route{std::string(argv[1])};
+  const std::shared_ptr<const Route> route = std::make_shared<const Route>(std::string(argv[1]));
 
-  // Load forecast irradiance csv
-  ForecastLut forecast_lut{std::string(argv[2])};
+  // Load forecast irradiance csv, and derive the sun geometry and daylight tables from it once for every
+  // simulator below
+  const ForecastTables forecast_tables =
+      make_forecast_tables(std::make_shared<const ForecastLut>(std::string(argv[2])));
 
-  // Create your model of the car
-  std::shared_ptr<Car> car = std::make_shared<Car>();
+  // Create your model of the car. The production car has its parameters compiled in; use Car for
+  // parameters chosen at runtime
+  std::shared_ptr<ProductionCar> car = std::make_shared<ProductionCar>();
 
   // First coordinate in baseroute.csv
-  const Coord starting_coord = route.get_route_points()[0];
+  const Coord starting_coord = route->get_route_points()[0];
 
   // Start time of the first race day
   const Time starting_time = Time("2023-10-22 10:00:00", -9.5);
 
   // Create your simulator object and set route parameters
-  Simulator simulator(car, starting_coord, starting_time);
+  ProductionSimulator simulator(car, starting_coord, starting_time);
   simulator.set_control_stops(control_stops);
-  simulator.set_forecast_lut(forecast_lut);
+  simulator.set_forecast_tables(forecast_tables);
   simulator.set_route(route);
 
   // Loop through viable speeds from 1 to 100
   for (int i=1; i<100; i++) {
     const double speed = kph2mps(i);
-    if (simulator.run_sim(speed)) {
+    const SimResult result = simulator.run_sim(speed);
+    if (result.feasible) {
+      std::cout << "Finished in " << result.elapsed_seconds << " seconds." << std::endl;
       std::cout << "Speed " << i << " is viable" << std::endl;
     } else {
+      std::cout << "Did not finish (" << sim_failure_name(result.failure) << ")." << std::endl;
       std::cout << "Speed " << i << " is not viable" << std::endl;
     }
   }
+  std::cout << "Batch kernels ran with " << simd_level_name(detect_simd_level()) << " instructions" << std::endl;
+  const PowerCache& power_cache = simulator.get_power_cache();
+  std::cout << "Power cache hit rate " << 100.0 * power_cache.get_hit_rate() << "% (" << power_cache.get_hits()
+            << " hits, " << power_cache.get_misses() << " misses)" << std::endl;
+
+  // Any car config files after the csvs are compared against each other on the same route and forecast
+  if (argc > 3) {
+    std::vector<CarParams> cars;
+    for (int arg = 3; arg < argc; arg++) {
+      cars.push_back(load_car_params(argv[arg]));
+    }
+
+    Simulator study(std::make_shared<Car>(), starting_coord, starting_time);
+    study.set_control_stops(control_stops);
+    study.set_forecast_tables(forecast_tables);
+    study.set_route(route);
+
+    std::vector<double> speeds;
+    for (int i=1; i<100; i++) {
+      speeds.push_back(kph2mps(i));
+    }
+    const std::vector<std::vector<SimResult>> results = run_car_batch(study, cars, speeds);
+
+    for (size_t c = 0; c < cars.size(); c++) {
+      int fastest = 0;
+      for (size_t s = 0; s < speeds.size(); s++) {
+        if (results[c][s].feasible) fastest = static_cast<int>(s) + 1;
+      }
+      if (fastest > 0) {
+        std::cout << argv[c + 3] << ": fastest viable speed " << fastest << " kph, finished in "
+                  << results[c][fastest - 1].elapsed_seconds << " seconds." << std::endl;
+      } else {
+        std::cout << argv[c + 3] << ": no viable speed" << std::endl;
+      }
+    }
+  }
   return 0;
 }
@@ -1,53 +1,266 @@
 #include "Car.hpp"
 
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <utility>
+#include <vector>
 
-// Write implemenation for your energy model here
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 
-#include <cmath>
 
-// Constants
-const double rho = 1.225;                 // Air density (kg/m^3)
-const double cda = 0.15;                  // Drag area (m^2)
-const double rolling_resistance = 0.0026; // Rolling resistance coefficient
-const double car_mass = 283.0;            // Car mass (kg)
-const double gravity = 9.81;              // Acceleration due to gravity (m/s^2)
-const double passive_loss = 20.0;         // Passive electric loss (W)
-const double array_area = 4.0;            // Solar array area (m^2)
-const double array_efficiency = 0.252;    // Solar array efficiency
-const double battery_efficiency = 0.98;   // Battery efficiency
-const double motor_efficiency = 0.8;      // Motor efficiency
+// The energy model itself lives in CarModel in Car.hpp so that it inlines into the simulator
 
-Car::Car() {}
+Car::Car() : car_params(PRODUCTION_CAR_PARAMS) {}
 
-// Calculate aerodynamic loss (W)
-double Car::calc_aero_loss(double velocity) {
-    return 0.5 * rho * cda * pow(velocity, 3);
+Car::Car(const CarParams& params) : car_params(params) {}
+
+/* Strip leading and trailing whitespace */
+static std::string trim(const std::string& str) {
+  const size_t first = str.find_first_not_of(" \t\r");
+  if (first == std::string::npos) return "";
+  const size_t last = str.find_last_not_of(" \t\r");
+  return str.substr(first, last - first + 1);
+}
+
+CarParams load_car_params(const std::string& path) {
+  std::ifstream file(path);
+  RUNTIME_EXCEPTION(file.is_open(), "Car config file not found " + path);
+
+  const std::pair<const char*, double CarParams::*> fields[] = {
+    {"air_density", &CarParams::air_density},
+    {"cda", &CarParams::cda},
+    {"rolling_resistance", &CarParams::rolling_resistance},
+    {"car_mass", &CarParams::car_mass},
+    {"gravity", &CarParams::gravity},
+    {"passive_loss", &CarParams::passive_loss},
+    {"array_area", &CarParams::array_area},
+    {"array_efficiency", &CarParams::array_efficiency},
+    {"battery_efficiency", &CarParams::battery_efficiency},
+    {"motor_efficiency", &CarParams::motor_efficiency},
+    {"wheel_radius", &CarParams::wheel_radius},
+  };
+
+  CarParams params;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) continue;
+
+    const size_t equals = line.find('=');
+    RUNTIME_EXCEPTION(equals != std::string::npos,
+                      "Expected name = value on line " + std::to_string(line_number) + " of " + path);
+    const std::string name = trim(line.substr(0, equals));
+    const std::string value = trim(line.substr(equals + 1));
+    RUNTIME_EXCEPTION(!value.empty() && isDouble(value),
+                      "Value " + value + " of " + name + " is not a number in car config " + path);
+
+    bool found = false;
+    for (const auto& [field_name, field] : fields) {
+      if (name == field_name) {
+        params.*field = std::stod(value);
+        found = true;
+      }
+    }
+    RUNTIME_EXCEPTION(found, "Unknown car parameter " + name + " in car config " + path);
+  }
+  return params;
 }
 
-// Calculate rolling resistance loss (W)
-double Car::calc_rolling_loss(double velocity) {
-    return rolling_resistance * car_mass * gravity * velocity;
+/* The batch kernels repeat the scalar model operation for operation, with the same constants
+   multiplied in the same order, and without fused multiply-adds (see CMakeLists.txt). IEEE
+   arithmetic is then bitwise identical across the scalar, AVX2 and AVX-512 paths */
+namespace {
+
+struct BatchConstants {
+  double aero;         // 0.5 * air_density * cda
+  double rolling;      // rolling_resistance * car_mass * gravity
+  double gravity;      // car_mass * gravity
+  double array_area;
+  double array_efficiency;
+  double battery_efficiency;
+  double motor_efficiency;
+  double passive_loss;
+
+  explicit BatchConstants(const CarParams& p) :
+    aero(0.5 * p.air_density * p.cda), rolling(p.rolling_resistance * p.car_mass * p.gravity),
+    gravity(p.car_mass * p.gravity), array_area(p.array_area), array_efficiency(p.array_efficiency),
+    battery_efficiency(p.battery_efficiency), motor_efficiency(p.motor_efficiency),
+    passive_loss(p.passive_loss) {}
+};
+
+inline double energy_scalar(const BatchConstants& c, double v, double s, double g) {
+  double aero = c.aero * v * v * v;
+  double rolling = c.rolling * v;
+  double gravity = c.gravity * v * s;
+  double solar = g * c.array_area * c.array_efficiency;
+  double total_losses = (aero + rolling + gravity) / c.motor_efficiency + c.passive_loss;
+  return solar * c.battery_efficiency - total_losses;
 }
 
-// Calculate gravitational loss/gain (W)
-double Car::calc_gravity_loss(double velocity, double angle) {
-    return car_mass * gravity * velocity * sin(angle);
+void batch_scalar(const BatchConstants& c, const double* v, const double* s, const double* g, double* out,
+                  size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    out[i] = energy_scalar(c, v[i], s[i], g[i]);
+  }
 }
 
-// Calculate solar energy gain (W)
-double Car::calc_solar_gain(double irradiance) {
-    return irradiance * array_area * array_efficiency;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAR_BATCH_X86 1
+
+__attribute__((target("avx2")))
+void batch_avx2(const BatchConstants& c, const double* v, const double* s, const double* g, double* out, size_t n) {
+  const __m256d aero_k = _mm256_set1_pd(c.aero);
+  const __m256d rolling_k = _mm256_set1_pd(c.rolling);
+  const __m256d gravity_k = _mm256_set1_pd(c.gravity);
+  const __m256d area_k = _mm256_set1_pd(c.array_area);
+  const __m256d array_eff_k = _mm256_set1_pd(c.array_efficiency);
+  const __m256d battery_eff_k = _mm256_set1_pd(c.battery_efficiency);
+  const __m256d motor_eff_k = _mm256_set1_pd(c.motor_efficiency);
+  const __m256d passive_k = _mm256_set1_pd(c.passive_loss);
+
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d vel = _mm256_loadu_pd(v + i);
+    const __m256d aero = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(aero_k, vel), vel), vel);
+    const __m256d rolling = _mm256_mul_pd(rolling_k, vel);
+    const __m256d gravity = _mm256_mul_pd(_mm256_mul_pd(gravity_k, vel), _mm256_loadu_pd(s + i));
+    const __m256d solar = _mm256_mul_pd(_mm256_mul_pd(_mm256_loadu_pd(g + i), area_k), array_eff_k);
+    const __m256d losses = _mm256_add_pd(
+        _mm256_div_pd(_mm256_add_pd(_mm256_add_pd(aero, rolling), gravity), motor_eff_k), passive_k);
+    _mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_mul_pd(solar, battery_eff_k), losses));
+  }
+  batch_scalar(c, v, s, g, out, i, n);
 }
 
-// Positive value indicates battery charging, negative indicates discharging
-double Car::energy_consumption(double velocity, double angle, double irradiance) {
-    double aero = calc_aero_loss(velocity);
-    double rolling = calc_rolling_loss(velocity);
-    double gravity = calc_gravity_loss(velocity, angle);
-    double solar = calc_solar_gain(irradiance);
+__attribute__((target("avx512f")))
+void batch_avx512(const BatchConstants& c, const double* v, const double* s, const double* g, double* out, size_t n) {
+  const __m512d aero_k = _mm512_set1_pd(c.aero);
+  const __m512d rolling_k = _mm512_set1_pd(c.rolling);
+  const __m512d gravity_k = _mm512_set1_pd(c.gravity);
+  const __m512d area_k = _mm512_set1_pd(c.array_area);
+  const __m512d array_eff_k = _mm512_set1_pd(c.array_efficiency);
+  const __m512d battery_eff_k = _mm512_set1_pd(c.battery_efficiency);
+  const __m512d motor_eff_k = _mm512_set1_pd(c.motor_efficiency);
+  const __m512d passive_k = _mm512_set1_pd(c.passive_loss);
+
+  for (size_t i = 0; i < n; i += 8) {
+    /* The last block only touches the lanes that are left */
+    const __mmask8 mask = (n - i >= 8) ? 0xFF : static_cast<__mmask8>((1u << (n - i)) - 1);
+    const __m512d vel = _mm512_maskz_loadu_pd(mask, v + i);
+    const __m512d aero = _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(aero_k, vel), vel), vel);
+    const __m512d rolling = _mm512_mul_pd(rolling_k, vel);
+    const __m512d gravity = _mm512_mul_pd(_mm512_mul_pd(gravity_k, vel), _mm512_maskz_loadu_pd(mask, s + i));
+    const __m512d solar = _mm512_mul_pd(_mm512_mul_pd(_mm512_maskz_loadu_pd(mask, g + i), area_k), array_eff_k);
+    const __m512d losses = _mm512_add_pd(
+        _mm512_div_pd(_mm512_add_pd(_mm512_add_pd(aero, rolling), gravity), motor_eff_k), passive_k);
+    _mm512_mask_storeu_pd(out + i, mask, _mm512_sub_pd(_mm512_mul_pd(solar, battery_eff_k), losses));
+  }
+}
+#endif
+
+/* Newton's method for the largest root of v^3 + P v + Q = 0 in every lane. Each lane starts from an
+   upper bound on its root, where the cubic is increasing and convex, so the iterates fall monotonically
+   onto the root. A root v > 0 has v^3 <= |P| v + |Q|, hence v <= max(sqrt(2|P|), cbrt(2|Q|)), and
+   cbrt(y) <= max(1, sqrt(y)). Lanes with no positive root come out as NaN.
+   The loops are plain C++ for the compiler to vectorize, at the width of the calling kernel's target */
+constexpr int CUBIC_NEWTON_MAX_PASSES = 100;
+
+__attribute__((always_inline))
+inline void cubic_newton(const double* __restrict P, const double* __restrict Q, double* __restrict v, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    const double root_bound_p = sqrt(2 * std::abs(P[i]));
+    const double root_bound_q = std::max(1.0, sqrt(2 * std::abs(Q[i])));
+    v[i] = std::max(root_bound_p, root_bound_q);
+  }
+  for (int pass = 0; pass < CUBIC_NEWTON_MAX_PASSES; pass++) {
+    int moving = 0;
+    for (size_t i = 0; i < n; i++) {
+      // Above the largest root the slope is positive, so a lane that reaches a non-positive slope or
+      // speed has no positive root. It is parked on NaN, which never counts as moving
+      const double slope = 3 * v[i] * v[i] + P[i];
+      const double step = ((v[i] * v[i] + P[i]) * v[i] + Q[i]) / slope;
+      const double next = v[i] - step;
+      v[i] = (slope > 0 && next > 0) ? next : std::numeric_limits<double>::quiet_NaN();
+      moving |= std::abs(step) > 1e-12 * next;
+    }
+    if (!moving) break;
+  }
+  for (size_t i = 0; i < n; i++) {
+    const double residual = (v[i] * v[i] + P[i]) * v[i] + Q[i];
+    const double scale = v[i] * v[i] * v[i] + std::abs(P[i]) * v[i] + std::abs(Q[i]);
+    const bool root = v[i] > 0 && std::abs(residual) <= 1e-9 * scale;
+    v[i] = root ? v[i] : std::numeric_limits<double>::quiet_NaN();
+  }
+}
+
+void cubic_newton_scalar(const double* P, const double* Q, double* v, size_t n) { cubic_newton(P, Q, v, n); }
+
+#ifdef CAR_BATCH_X86
+__attribute__((target("avx2")))
+void cubic_newton_avx2(const double* P, const double* Q, double* v, size_t n) { cubic_newton(P, Q, v, n); }
+
+__attribute__((target("avx512f")))
+void cubic_newton_avx512(const double* P, const double* Q, double* v, size_t n) { cubic_newton(P, Q, v, n); }
+#endif
+
+}  // namespace
+
+void energy_consumption_batch(const CarParams& params, std::span<const double> velocity,
+                              std::span<const double> sin_grade, std::span<const double> irradiance,
+                              std::span<double> out, SimdLevel level) {
+  const size_t n = out.size();
+  RUNTIME_EXCEPTION(velocity.size() == n && sin_grade.size() == n && irradiance.size() == n,
+                    "Batch energy inputs and output must all have the same length");
+  const BatchConstants c(params);
+
+  level = clamp_simd_level(level);
+
+#ifdef CAR_BATCH_X86
+  if (level == SimdLevel::Avx512) {
+    batch_avx512(c, velocity.data(), sin_grade.data(), irradiance.data(), out.data(), n);
+    return;
+  }
+  if (level == SimdLevel::Avx2) {
+    batch_avx2(c, velocity.data(), sin_grade.data(), irradiance.data(), out.data(), n);
+    return;
+  }
+#endif
+  batch_scalar(c, velocity.data(), sin_grade.data(), irradiance.data(), out.data(), 0, n);
+}
+
+void speed_for_energy_batch(const CarParams& params, std::span<const double> energy, std::span<const double> distance,
+                            std::span<const double> sin_grade, std::span<const double> irradiance,
+                            std::span<double> out, SimdLevel level) {
+  const size_t n = out.size();
+  RUNTIME_EXCEPTION(energy.size() == n && distance.size() == n && sin_grade.size() == n && irradiance.size() == n,
+                    "Batch speed inputs and output must all have the same length");
+  const PowerCoefficients k = Car(params).get_power_coefficients();
+
+  /* The cubic of each stretch in monic form, as in speed_for_energy */
+  std::vector<double> P(n);
+  std::vector<double> Q(n);
+  for (size_t i = 0; i < n; i++) {
+    RUNTIME_EXCEPTION(distance[i] > 0, "Stretch distances must be positive, got " << distance[i] << " at " << i);
+    P[i] = (k.linear + k.grade * sin_grade[i] - energy[i] / distance[i]) / k.cubic;
+    Q[i] = (k.constant - k.solar * irradiance[i]) / k.cubic;
+  }
 
-    double total_losses = (aero + rolling + gravity) / motor_efficiency + passive_loss;
+  level = clamp_simd_level(level);
 
-    // Net power = solar gain - total losses, adjusted for battery efficiency
-    return solar * battery_efficiency - total_losses;
+#ifdef CAR_BATCH_X86
+  if (level == SimdLevel::Avx512) {
+    cubic_newton_avx512(P.data(), Q.data(), out.data(), n);
+    return;
+  }
+  if (level == SimdLevel::Avx2) {
+    cubic_newton_avx2(P.data(), Q.data(), out.data(), n);
+    return;
+  }
+#endif
+  cubic_newton_scalar(P.data(), Q.data(), out.data(), n);
 }
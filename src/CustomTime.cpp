@@ -3,29 +3,135 @@
 #include <cmath>
 #include <ctime>
 #include <chrono>
-#include <iomanip>
+#include <cstring>
 #include <sstream>
 
 #include "CustomTime.hpp"
 #include "Utils.hpp"
 
-Time::Time(std::string local_time_point, double utc_adjustment) {
-  local_time = local_time_point;
-  std::istringstream iss(local_time_point);
-  std::string date_str, time_str;
-  iss >> date_str >> time_str;
-  if (time_str.empty()) {
-    /* The timestamp is in HH:MM:SS format, call the other constructor */
-    HH_MM_SS_constructor(local_time_point);
-    return;
+/* Check that the calendar fields form a real date and time of day */
+static bool valid_civil(int64_t year, unsigned month, unsigned day, unsigned hour, unsigned minute, unsigned second) {
+  static constexpr unsigned DAYS_IN_MONTH[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  if (month < 1 || month > 12 || day < 1 || day > DAYS_IN_MONTH[month - 1]) return false;
+  const bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  if (month == 2 && day == 29 && !leap) return false;
+  return hour < 24 && minute < 60 && second < 60;
+}
+
+/* Write a value as exactly width decimal digits, zero padded, and return the end */
+static char* write_digits(char* out, unsigned value, const int width) {
+  for (int i = width - 1; i >= 0; i--) {
+    out[i] = static_cast<char>('0' + value % 10);
+    value /= 10;
   }
+  return out + width;
+}
 
-  std::istringstream rss(local_time_point);
-  date::sys_time<std::chrono::seconds> epoch_time;
-  rss >> date::parse("%F %T", epoch_time);
+/* Longest date write_date can produce, with the sign and all digits of an int year */
+static constexpr size_t MAX_DATE_SIZE = 17;
 
-  // Convert sys_time to time_t
-  time_t local_time_t = std::chrono::system_clock::to_time_t(epoch_time);
+/* Write YYYY-MM-DD and return the end. Years outside 0 to 9999 are written with as many digits as they need */
+static char* write_date(char* out, const int year, const unsigned month, const unsigned day) {
+  if (year >= 0 && year <= 9999) {
+    out = write_digits(out, static_cast<unsigned>(year), 4);
+  } else {
+    out = std::to_chars(out, out + 11, year).ptr;
+  }
+  *out++ = '-';
+  out = write_digits(out, month, 2);
+  *out++ = '-';
+  return write_digits(out, day, 2);
+}
+
+/* Write HH:MM:SS and return the end */
+static char* write_hh_mm_ss(char* out, const unsigned hour, const unsigned minute, const unsigned second) {
+  out = write_digits(out, hour, 2);
+  *out++ = ':';
+  out = write_digits(out, minute, 2);
+  *out++ = ':';
+  return write_digits(out, second, 2);
+}
+
+/* Copy formatted characters into a caller's buffer, or report that they do not fit */
+static std::to_chars_result copy_chars(char* first, char* last, const char* text, const size_t size) {
+  if (static_cast<size_t>(last - first) < size) return {last, std::errc::value_too_large};
+  std::memcpy(first, text, size);
+  return {first + size, std::errc()};
+}
+
+std::to_chars_result format_civil_time(char* first, char* last, const CivilTime& civil) {
+  char text[MAX_DATE_SIZE + 13];
+  char* out = write_date(text, civil.year, civil.month, civil.day);
+  *out++ = ' ';
+  out = write_hh_mm_ss(out, civil.hour, civil.minute, civil.second);
+  *out++ = '.';
+  out = write_digits(out, civil.millisecond, 3);
+  return copy_chars(first, last, text, static_cast<size_t>(out - text));
+}
+
+bool packed_timestamp_to_epoch(uint64_t packed, time_t* epoch) {
+  const unsigned second = packed % 100;
+  packed /= 100;
+  const unsigned minute = packed % 100;
+  packed /= 100;
+  const unsigned hour = packed % 100;
+  packed /= 100;
+  const unsigned day = packed % 100;
+  packed /= 100;
+  const unsigned month = packed % 100;
+  packed /= 100;
+  if (packed > 99) return false;
+  const int64_t year = 2000 + static_cast<int64_t>(packed);
+
+  if (!valid_civil(year, month, day, hour, minute, second)) return false;
+  *epoch = static_cast<time_t>(epoch_from_civil(year, month, day, hour, minute, second));
+  return true;
+}
+
+bool parse_date_time(std::string_view time_point, time_t* epoch) {
+  /* Layout of YYYY-MM-DD HH:MM:SS, with the separator expected after each field */
+  static constexpr char LAYOUT[] = "dddd-dd-dd dd:dd:dd";
+  if (time_point.size() != sizeof(LAYOUT) - 1) return false;
+  for (size_t i = 0; i < time_point.size(); i++) {
+    const bool is_digit = time_point[i] >= '0' && time_point[i] <= '9';
+    if (LAYOUT[i] == 'd' ? !is_digit : time_point[i] != LAYOUT[i]) return false;
+  }
+
+  auto field = [&](size_t pos, size_t width) -> unsigned {
+    unsigned value = 0;
+    for (size_t i = pos; i < pos + width; i++) value = value * 10 + (time_point[i] - '0');
+    return value;
+  };
+  const int64_t year = field(0, 4);
+  const unsigned month = field(5, 2), day = field(8, 2);
+  const unsigned hour = field(11, 2), minute = field(14, 2), second = field(17, 2);
+
+  if (!valid_civil(year, month, day, hour, minute, second)) return false;
+  *epoch = static_cast<time_t>(epoch_from_civil(year, month, day, hour, minute, second));
+  return true;
+}
+
+Time::Time(std::string local_time_point, double utc_adjustment) {
+  local_time = local_time_point;
+  time_t local_time_t;
+  if (!parse_date_time(local_time_point, &local_time_t)) {
+    std::istringstream iss(local_time_point);
+    std::string date_str, time_str;
+    iss >> date_str >> time_str;
+    if (time_str.empty()) {
+      /* The timestamp is in HH:MM:SS format, call the other constructor */
+      HH_MM_SS_constructor(local_time_point);
+      return;
+    }
+
+    /* Not zero padded, fall back to the date library's parser */
+    std::istringstream rss(local_time_point);
+    date::sys_time<std::chrono::seconds> epoch_time;
+    rss >> date::parse("%F %T", epoch_time);
+
+    // Convert sys_time to time_t
+    local_time_t = std::chrono::system_clock::to_time_t(epoch_time);
+  }
 
   t_datetime_local = local_time_t;
 
@@ -53,8 +159,9 @@ void Time::HH_MM_SS_constructor(const std::string local_time_point) {
   char delimiter;
   iss >> hours >> delimiter >> minutes >> delimiter >> seconds;
 
-  time_t now = time(nullptr);
-  LOCALTIME_SAFE(&now, &m_datetime_local);
+  /* The date fields are meaningless, start from the epoch so they do not depend on the host's clock or timezone */
+  const time_t epoch = 0;
+  GMTIME_SAFE(&epoch, &m_datetime_local);
   m_datetime_local.tm_hour = hours;
   m_datetime_local.tm_min = minutes;
   m_datetime_local.tm_sec = seconds;
@@ -208,25 +315,36 @@ bool Time::operator<=(const Time& other) const {
   return true;
 }
 
-std::string Time::get_local_readable_time() const {
-  std::ostringstream oss;
-
+/* Readable form of a Time's calendar fields */
+static std::to_chars_result format_tm(char* first, char* last, const tm& datetime, const uint64_t milliseconds,
+                                      const bool hh_mm_ss_only) {
   if (hh_mm_ss_only) {
-      oss << std::setw(2) << std::setfill('0') << m_datetime_local.tm_hour << ":"
-          << std::setw(2) << std::setfill('0') << m_datetime_local.tm_min << ":"
-          << std::setw(2) << std::setfill('0') << m_datetime_local.tm_sec;
-      return oss.str();
+    char text[8];
+    write_hh_mm_ss(text, datetime.tm_hour, datetime.tm_min, datetime.tm_sec);
+    return copy_chars(first, last, text, sizeof(text));
   }
+  CivilTime civil;
+  civil.year = datetime.tm_year + 1900;
+  civil.month = static_cast<unsigned>(datetime.tm_mon + 1);
+  civil.day = static_cast<unsigned>(datetime.tm_mday);
+  civil.hour = static_cast<unsigned>(datetime.tm_hour);
+  civil.minute = static_cast<unsigned>(datetime.tm_min);
+  civil.second = static_cast<unsigned>(datetime.tm_sec);
+  civil.millisecond = static_cast<unsigned>(milliseconds);
+  return format_civil_time(first, last, civil);
+}
 
-  oss << std::setw(4) << std::setfill('0') << (m_datetime_local.tm_year + 1900) << "-"
-      << std::setw(2) << std::setfill('0') << (m_datetime_local.tm_mon + 1) << "-"
-      << std::setw(2) << std::setfill('0') << m_datetime_local.tm_mday << " "
-      << std::setw(2) << std::setfill('0') << m_datetime_local.tm_hour << ":"
-      << std::setw(2) << std::setfill('0') << m_datetime_local.tm_min << ":"
-      << std::setw(2) << std::setfill('0') << m_datetime_local.tm_sec << "."
-      << std::setw(3) << std::setfill('0') << m_milliseconds;
+std::string Time::get_local_readable_time() const {
+  char text[MAX_DATE_SIZE + 13];
+  return std::string(text, to_local_chars(text, text + sizeof(text)).ptr);
+}
 
-  return oss.str();
+std::to_chars_result Time::to_local_chars(char* first, char* last) const {
+  return format_tm(first, last, m_datetime_local, m_milliseconds, hh_mm_ss_only);
+}
+
+std::to_chars_result Time::to_utc_chars(char* first, char* last) const {
+  return format_tm(first, last, m_datetime_utc, m_milliseconds, hh_mm_ss_only);
 }
 
 void Time::update_time_seconds(const double seconds) {
@@ -267,22 +385,118 @@ double Time::operator-(const Time& other) const {
 }
 
 std::string Time::get_utc_readable_time() const {
-  std::ostringstream oss;
+  char text[MAX_DATE_SIZE + 13];
+  return std::string(text, to_utc_chars(text, text + sizeof(text)).ptr);
+}
 
-  if (hh_mm_ss_only) {
-      oss << std::setw(2) << std::setfill('0') << m_datetime_utc.tm_hour << ":"
-          << std::setw(2) << std::setfill('0') << m_datetime_utc.tm_min << ":"
-          << std::setw(2) << std::setfill('0') << m_datetime_utc.tm_sec;
-      return oss.str();
+EpochTime::EpochTime(const Time& time) {
+  RUNTIME_EXCEPTION(!time.hh_mm_ss_only, "Cannot convert HH:MM:SS only timestamp to an epoch time");
+  local_ms = static_cast<int64_t>(time.t_datetime_local) * 1000 + static_cast<int64_t>(time.m_milliseconds);
+  utc_adjustment_ms = std::llround(time.utc_adjustment * 1000.0);
+}
+
+EpochTime::operator Time() const {
+  Time time;
+  time.t_datetime_local = static_cast<time_t>(floor_div_ms(local_ms));
+  time.m_milliseconds = static_cast<uint64_t>(local_ms - static_cast<int64_t>(time.t_datetime_local) * 1000);
+  time.utc_adjustment = utc_adjustment_ms / 1000.0;
+  time.t_datetime_utc = time.t_datetime_local + time.utc_adjustment;
+  GMTIME_SAFE(&time.t_datetime_local, &time.m_datetime_local);
+  GMTIME_SAFE(&time.t_datetime_utc, &time.m_datetime_utc);
+  time.hh_mm_ss_only = false;
+  return time;
+}
+
+/* Split milliseconds since the epoch into calendar fields with the date library's civil algorithms */
+static CivilTime civil_from_milliseconds(const int64_t ms) {
+  const date::sys_time<std::chrono::milliseconds> time_point{std::chrono::milliseconds{ms}};
+  const date::sys_days day = date::floor<date::days>(time_point);
+  const date::year_month_day ymd{day};
+  const date::hh_mm_ss<std::chrono::milliseconds> hms{time_point - day};
+
+  CivilTime civil;
+  civil.year = static_cast<int>(ymd.year());
+  civil.month = static_cast<unsigned>(ymd.month());
+  civil.day = static_cast<unsigned>(ymd.day());
+  civil.hour = static_cast<unsigned>(hms.hours().count());
+  civil.minute = static_cast<unsigned>(hms.minutes().count());
+  civil.second = static_cast<unsigned>(hms.seconds().count());
+  civil.millisecond = static_cast<unsigned>(hms.subseconds().count());
+  return civil;
+}
+
+CivilTime EpochTime::get_local_civil() const {
+  return civil_from_milliseconds(local_ms);
+}
+
+CivilTime EpochTime::get_utc_civil() const {
+  return civil_from_milliseconds(get_utc_milliseconds());
+}
+
+std::string EpochTime::get_local_readable_time() const {
+  char text[MAX_DATE_SIZE + 13];
+  return std::string(text, to_local_chars(text, text + sizeof(text)).ptr);
+}
+
+std::string EpochTime::get_utc_readable_time() const {
+  char text[MAX_DATE_SIZE + 13];
+  return std::string(text, to_utc_chars(text, text + sizeof(text)).ptr);
+}
+
+std::to_chars_result EpochTime::to_local_chars(char* first, char* last) const {
+  return format_civil_time(first, last, get_local_civil());
+}
+
+std::to_chars_result EpochTime::to_utc_chars(char* first, char* last) const {
+  return format_civil_time(first, last, get_utc_civil());
+}
+
+/* Bulk formatting of the milliseconds since the epoch that milliseconds(i) returns for i < count */
+template <typename Milliseconds>
+static std::to_chars_result format_epoch_milliseconds(char* first, char* last, const size_t count,
+                                                      Milliseconds&& milliseconds, const char separator) {
+  constexpr int64_t ms_per_day = 86400000;
+  char date[MAX_DATE_SIZE];
+  size_t date_size = 0;
+  int64_t date_day = 0;
+  bool have_date = false;
+
+  char* out = first;
+  for (size_t i = 0; i < count; i++) {
+    const int64_t ms = milliseconds(i);
+    const int64_t day = ms / ms_per_day - (ms % ms_per_day < 0 ? 1 : 0);
+    if (!have_date || day != date_day) {
+      const CivilTime civil = civil_from_milliseconds(ms);
+      date_size = static_cast<size_t>(write_date(date, civil.year, civil.month, civil.day) - date);
+      date_day = day;
+      have_date = true;
+    }
+    // Date, space, HH:MM:SS.mmm and the separator
+    if (static_cast<size_t>(last - out) < date_size + 14) return {last, std::errc::value_too_large};
+    std::memcpy(out, date, date_size);
+    out += date_size;
+    *out++ = ' ';
+    const unsigned ms_of_day = static_cast<unsigned>(ms - day * ms_per_day);
+    out = write_hh_mm_ss(out, ms_of_day / 3600000, ms_of_day / 60000 % 60, ms_of_day / 1000 % 60);
+    *out++ = '.';
+    out = write_digits(out, ms_of_day % 1000, 3);
+    *out++ = separator;
   }
+  return {out, std::errc()};
+}
 
-  oss << std::setw(4) << std::setfill('0') << (m_datetime_utc.tm_year + 1900) << "-"
-      << std::setw(2) << std::setfill('0') << (m_datetime_utc.tm_mon + 1) << "-"
-      << std::setw(2) << std::setfill('0') << m_datetime_utc.tm_mday << " "
-      << std::setw(2) << std::setfill('0') << m_datetime_utc.tm_hour << ":"
-      << std::setw(2) << std::setfill('0') << m_datetime_utc.tm_min << ":"
-      << std::setw(2) << std::setfill('0') << m_datetime_utc.tm_sec << "."
-      << std::setw(3) << std::setfill('0') << m_milliseconds;
+std::to_chars_result format_epoch_times(char* first, char* last, std::span<const int64_t> epoch_milliseconds,
+                                        const char separator) {
+  return format_epoch_milliseconds(first, last, epoch_milliseconds.size(),
+                                   [&](const size_t i) { return epoch_milliseconds[i]; }, separator);
+}
 
-  return oss.str();
+std::to_chars_result format_epoch_times(char* first, char* last, std::span<const EpochTime> times, const bool utc,
+                                        const char separator) {
+  if (utc) {
+    return format_epoch_milliseconds(first, last, times.size(),
+                                     [&](const size_t i) { return times[i].get_utc_milliseconds(); }, separator);
+  }
+  return format_epoch_milliseconds(first, last, times.size(),
+                                   [&](const size_t i) { return times[i].get_local_milliseconds(); }, separator);
 }
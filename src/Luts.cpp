@@ -1,14 +1,21 @@
 #include "Luts.hpp"
+#include "CustomTime.hpp"
 #include "date.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
 #include <fstream>
+#include <limits>
+#include <thread>
 
 template <typename T>
 BaseLut<T>::BaseLut(const std::filesystem::path path) {
   lut_path = path;
 }
 
-ForecastLut::ForecastLut(const std::string path) :
-  BaseLut<double>(std::filesystem::path(path)) {
+ForecastLut::ForecastLut(const std::string path, const std::string channel_name) :
+  BaseLut<double>(std::filesystem::path(path)), channel_names{channel_name} {
     std::cout << "Csv: " << lut_path.string() << std::endl;
     load_LUT();
 }
@@ -18,41 +25,28 @@ void ForecastLut::load_LUT() {
   RUNTIME_EXCEPTION(file.is_open(), "Forecast file not found " + lut_path.string());
   std::string times_line;
   file >> times_line;
-  std::stringstream times_stream(times_line);
-
-  // Remove 'latitude' and 'longitude' from first 2 cols of csv input.
-  std::string time;
-  std::getline(times_stream, time, ',');
-  std::getline(times_stream, time, ',');
-
-  /* Create an array of the time keys */
-  while (!times_stream.eof()) {
-    std::getline(times_stream, time, ',');
-    RUNTIME_EXCEPTION(isDouble(time), "Time " + time + " is not a number in ForecastLUT " + lut_path.string());
-    uint64_t temp_time = std::stoull(time);
-    int seconds = temp_time % 100;
-    temp_time /= 100;
-    int minutes = temp_time % 100;
-    temp_time /= 100;
-    int hours = temp_time % 100;
-    temp_time /= 100;
-    int days = temp_time % 100;
-    temp_time /= 100;
-    int month = (temp_time % 100);
-    temp_time /= 100;
-    int year = temp_time;
-
-    /* Construct YYYY-MM-DD HH:MM:SS string */
-    std::string forecast_time = "20" + std::to_string(year) + "-" + std::to_string(month) + "-"
-      + std::to_string(days) + " " + std::to_string(hours) + ":" + std::to_string(minutes) + ":"
-      + std::to_string(seconds);
-
-    std::istringstream iss(forecast_time);
-    date::sys_time<std::chrono::seconds> epoch_time;
-    iss >> date::parse("%F %T", epoch_time);
-    time_t local_time_t = std::chrono::system_clock::to_time_t(epoch_time);
-
+  if (!times_line.empty() && times_line.back() == '\r') times_line.pop_back();
+
+  /* Create an array of the time keys, skipping 'latitude' and 'longitude' in the first 2 cols of csv input */
+  forecast_times.reserve(std::count(times_line.begin(), times_line.end(), ','));
+  const char* cell = times_line.data();
+  const char* const line_end = cell + times_line.size();
+  for (int skipped = 0; skipped < 2 && cell != line_end; skipped++) {
+    cell = std::find(cell, line_end, ',');
+    if (cell != line_end) cell++;
+  }
+  while (cell != line_end) {
+    const char* cell_end = std::find(cell, line_end, ',');
+    const std::string_view time(cell, cell_end - cell);
+    uint64_t packed_time = 0;
+    const std::from_chars_result parsed = std::from_chars(cell, cell_end, packed_time);
+    RUNTIME_EXCEPTION(parsed.ec == std::errc() && parsed.ptr == cell_end,
+                      "Time " + std::string(time) + " is not a number in ForecastLUT " + lut_path.string());
+    time_t local_time_t;
+    RUNTIME_EXCEPTION(packed_timestamp_to_epoch(packed_time, &local_time_t),
+                      "Time " + std::string(time) + " is not a valid timestamp in ForecastLUT " + lut_path.string());
     forecast_times.push_back(local_time_t);
+    cell = cell_end == line_end ? line_end : cell_end + 1;
   }
 
   int row_counter = 0;
@@ -95,14 +89,69 @@ void ForecastLut::load_LUT() {
   this->num_rows = forecast_coords.size();
   this->num_cols = forecast_times.size();
 
+  precompute_integrals();
+
   row_cache = 0;
   column_cache = 0;
 }
 
 double ForecastLut::get_value(ForecastCoord coord, time_t time) {
-  double row_key;
-  double col_key;
+  size_t row_key = find_row(coord);
+  size_t col_key = find_column(time);
+
+  RUNTIME_EXCEPTION(row_key < num_rows && col_key < num_cols,
+                    "Out of bounds access in Forecast LUT " + lut_path.string());
+  return this->values[row_key][col_key * num_channels];
+}
+
+size_t ForecastLut::add_channel(const std::string& channel_name, const std::string& path) {
+  RUNTIME_EXCEPTION(find_channel(channel_name) == num_channels,
+                    "Channel " + channel_name + " already in Forecast LUT " + lut_path.string());
+  const ForecastLut channel(path, channel_name);
+  RUNTIME_EXCEPTION(channel.forecast_times == forecast_times,
+                    "Timestamps of " + path + " do not match Forecast LUT " + lut_path.string());
+  RUNTIME_EXCEPTION(channel.num_rows == num_rows, "Rows of " + path + " do not match Forecast LUT " + lut_path.string());
+  for (size_t row = 0; row < num_rows; row++) {
+    RUNTIME_EXCEPTION(channel.forecast_coords[row].lat == forecast_coords[row].lat &&
+                      channel.forecast_coords[row].lon == forecast_coords[row].lon,
+                      "Coordinates of " + path + " do not match Forecast LUT " + lut_path.string());
+  }
+
+  /* Widen every cell by one value */
+  const size_t new_num_channels = num_channels + 1;
+  for (size_t row = 0; row < num_rows; row++) {
+    std::vector<double> interleaved(num_cols * new_num_channels);
+    for (size_t col = 0; col < num_cols; col++) {
+      std::copy_n(&this->values[row][col * num_channels], num_channels, &interleaved[col * new_num_channels]);
+      interleaved[col * new_num_channels + num_channels] = channel.values[row][col];
+    }
+    this->values[row] = std::move(interleaved);
+  }
+  num_channels = new_num_channels;
+  channel_names.push_back(channel_name);
+  return num_channels - 1;
+}
+
+size_t ForecastLut::find_channel(const std::string& channel_name) const {
+  return std::find(channel_names.begin(), channel_names.end(), channel_name) - channel_names.begin();
+}
+
+std::pair<double, double> ForecastLut::get_channel_range(size_t channel) const {
+  RUNTIME_EXCEPTION(channel < num_channels && num_rows > 0 && num_cols > 0,
+                    "Out of bounds access in Forecast LUT " + lut_path.string());
+  std::pair<double, double> range{this->values[0][channel], this->values[0][channel]};
+  for (size_t row = 0; row < num_rows; row++) {
+    for (size_t col = 0; col < num_cols; col++) {
+      const double value = this->values[row][col * num_channels + channel];
+      range.first = std::min(range.first, value);
+      range.second = std::max(range.second, value);
+    }
+  }
+  return range;
+}
 
+size_t ForecastLut::find_row(ForecastCoord coord) const {
+  size_t row_key = num_rows;
   double min_distance = std::numeric_limits<double>::max();
   for (size_t row=0; row < num_rows; row++) {
     ForecastCoord forecast_coord = forecast_coords[row];
@@ -112,20 +161,118 @@ double ForecastLut::get_value(ForecastCoord coord, time_t time) {
       row_key = row;
     }
   }
+  return row_key;
+}
+
+/* Distance in seconds between a time and a column key, measured the same way as get_value */
+static double column_time_distance(time_t time, time_t forecast_time) {
+  int time_diff = time - forecast_time;
+  return std::abs(static_cast<double>(time_diff));
+}
 
+size_t ForecastLut::find_column(time_t time) const {
+  size_t col_key = num_cols;
   double min_time = std::numeric_limits<double>::max();
   for (size_t col=0; col < num_cols; col++) {
-    uint64_t forecast_time = forecast_times[col];
-    int time_diff = time - forecast_time;
-    if (std::abs(static_cast<double>(time_diff)) < min_time) {
-      min_time = std::abs(static_cast<double>(time_diff));
+    double time_diff = column_time_distance(time, forecast_times[col]);
+    if (time_diff < min_time) {
+      min_time = time_diff;
       col_key = col;
     }
   }
+  return col_key;
+}
 
-  RUNTIME_EXCEPTION(row_key >= 0 && row_key < num_rows && col_key >= 0 && col_key < num_cols,
-                    "Out of bounds access in Forecast LUT " + lut_path.string());
-  return this->values[row_key][col_key];
+/* Timestamps are sorted, so the distance to the key falls and then rises across the columns.
+   Walking downhill lands on the same column as find_column, including its preference for the
+   earlier column on a tie */
+void ForecastLut::advance_column(ForecastCursor& cursor, time_t time) const {
+  size_t col = cursor.column;
+  while (col + 1 < num_cols &&
+         column_time_distance(time, forecast_times[col + 1]) < column_time_distance(time, forecast_times[col])) {
+    col++;
+  }
+  while (col > 0 &&
+         column_time_distance(time, forecast_times[col - 1]) <= column_time_distance(time, forecast_times[col])) {
+    col--;
+  }
+  cursor.column = col;
+}
+
+void ForecastLut::precompute_integrals() {
+  column_boundaries.resize(num_cols > 0 ? num_cols - 1 : 0);
+  for (size_t col = 0; col + 1 < num_cols; col++) {
+    column_boundaries[col] = 0.5 * (static_cast<double>(forecast_times[col]) + static_cast<double>(forecast_times[col + 1]));
+  }
+
+  /* Prefix sums of value * cell width. The first cell is anchored at the first timestamp */
+  auto running_integral = [&](const double* row, size_t stride) {
+    std::vector<double> integrals(num_cols, 0.0);
+    double cell_start = num_cols > 0 ? static_cast<double>(forecast_times[0]) : 0.0;
+    for (size_t col = 0; col + 1 < num_cols; col++) {
+      integrals[col + 1] = integrals[col] + row[col * stride] * (column_boundaries[col] - cell_start);
+      cell_start = column_boundaries[col];
+    }
+    return integrals;
+  };
+
+  row_integrals.resize(num_rows);
+  for (size_t row = 0; row < num_rows; row++) {
+    row_integrals[row] = running_integral(this->values[row].data(), num_channels);
+  }
+
+  std::vector<double> column_max(num_cols, 0.0);
+  for (size_t row = 0; row < num_rows; row++) {
+    for (size_t col = 0; col < num_cols; col++) {
+      column_max[col] = std::max(column_max[col], this->values[row][col * num_channels]);
+    }
+  }
+  column_envelope.resize(num_cols);
+  for (size_t col = 0; col < num_cols; col++) {
+    double envelope = column_max[col];
+    if (col > 0) envelope = std::max(envelope, column_max[col - 1]);
+    if (col + 1 < num_cols) envelope = std::max(envelope, column_max[col + 1]);
+    column_envelope[col] = envelope;
+  }
+  envelope_integral = running_integral(column_envelope.data(), 1);
+}
+
+size_t ForecastLut::column_cell(double time) const {
+  /* Ties go to the earlier column, as in find_column */
+  return std::lower_bound(column_boundaries.begin(), column_boundaries.end(), time) - column_boundaries.begin();
+}
+
+double ForecastLut::integral_to(const double* row, size_t stride, const std::vector<double>& integrals,
+                                double time) const {
+  const size_t col = column_cell(time);
+  const double cell_start = col == 0 ? static_cast<double>(forecast_times[0]) : column_boundaries[col - 1];
+  return integrals[col] + row[col * stride] * (time - cell_start);
+}
+
+double ForecastLut::get_integral(size_t row, double start, double end) const {
+  RUNTIME_EXCEPTION(row < num_rows && num_cols > 0, "Out of bounds access in Forecast LUT " + lut_path.string());
+  const double* values_row = this->values[row].data();
+  return integral_to(values_row, num_channels, row_integrals[row], end) -
+         integral_to(values_row, num_channels, row_integrals[row], start);
+}
+
+double ForecastLut::get_upper_bound_integral(double start, double end) const {
+  RUNTIME_EXCEPTION(num_cols > 0, "Empty Forecast LUT " + lut_path.string());
+  return integral_to(column_envelope.data(), 1, envelope_integral, end) -
+         integral_to(column_envelope.data(), 1, envelope_integral, start);
+}
+
+ForecastLut ForecastLut::with_incidence(const SunGeometryLut& sun) const {
+  RUNTIME_EXCEPTION(sun.get_num_rows() == num_rows && sun.get_num_cols() == num_cols,
+                    "Sun geometry does not match Forecast LUT " + lut_path.string());
+  ForecastLut projected = *this;
+  for (size_t row = 0; row < num_rows; row++) {
+    for (size_t col = 0; col < num_cols; col++) {
+      projected.values[row][col * num_channels] *= sun.get_flat_incidence(row, col);
+    }
+  }
+  projected.precompute_integrals();
+  return projected;
 }
 
 void ForecastLut::initialize_caches(ForecastCoord coord, time_t time) {
@@ -200,7 +347,7 @@ void ForecastLut::update_index_cache(ForecastCoord coord, time_t time) {
 }
 
 double ForecastLut::get_value_with_cache() {
-  return this->values[row_cache][column_cache];
+  return this->values[row_cache][column_cache * num_channels];
 }
 
 Route::Route(const std::string lut_path) {
@@ -235,5 +382,611 @@ Route::Route(const std::string lut_path) {
       route_points.emplace_back(coord);
     }
   }
+
+  precompute_segments();
+  build_grid();
+}
+
+/* Side of a nearest point grid cell in degrees. About 5km, a few dozen route points per cell */
+static constexpr double ROUTE_GRID_CELL_DEGREES = 0.05;
+
+void Route::build_grid() {
+  grid_rows = 0;
+  grid_cols = 0;
+  grid_cell_starts.clear();
+  grid_points.clear();
+  if (route_points.empty()) return;
+
+  double max_lat = route_points[0].lat;
+  double max_lon = route_points[0].lon;
+  grid_min_lat = route_points[0].lat;
+  grid_min_lon = route_points[0].lon;
+  for (const Coord& point : route_points) {
+    grid_min_lat = std::min(grid_min_lat, point.lat);
+    grid_min_lon = std::min(grid_min_lon, point.lon);
+    max_lat = std::max(max_lat, point.lat);
+    max_lon = std::max(max_lon, point.lon);
+  }
+  grid_rows = static_cast<size_t>((max_lat - grid_min_lat) / ROUTE_GRID_CELL_DEGREES) + 1;
+  grid_cols = static_cast<size_t>((max_lon - grid_min_lon) / ROUTE_GRID_CELL_DEGREES) + 1;
+
+  /* Counting sort of the points by cell */
+  std::vector<size_t> point_cells(route_points.size());
+  grid_cell_starts.assign(grid_rows * grid_cols + 1, 0);
+  for (size_t i = 0; i < route_points.size(); i++) {
+    const size_t row = static_cast<size_t>((route_points[i].lat - grid_min_lat) / ROUTE_GRID_CELL_DEGREES);
+    const size_t col = static_cast<size_t>((route_points[i].lon - grid_min_lon) / ROUTE_GRID_CELL_DEGREES);
+    point_cells[i] = row * grid_cols + col;
+    grid_cell_starts[point_cells[i] + 1]++;
+  }
+  for (size_t c = 0; c < grid_rows * grid_cols; c++) {
+    grid_cell_starts[c + 1] += grid_cell_starts[c];
+  }
+  grid_points.resize(route_points.size());
+  std::vector<size_t> fill = grid_cell_starts;
+  for (size_t i = 0; i < route_points.size(); i++) {
+    grid_points[fill[point_cells[i]]++] = i;
+  }
+}
+
+size_t Route::find_nearest_point(const Coord& coord) const {
+  RUNTIME_EXCEPTION(!route_points.empty(), "Nearest point query on an empty route");
+
+  /* Cell of the query, clamped onto the grid */
+  const double lat_offset = (coord.lat - grid_min_lat) / ROUTE_GRID_CELL_DEGREES;
+  const double lon_offset = (coord.lon - grid_min_lon) / ROUTE_GRID_CELL_DEGREES;
+  const long centre_row = std::clamp(static_cast<long>(std::floor(lat_offset)), 0L, static_cast<long>(grid_rows) - 1);
+  const long centre_col = std::clamp(static_cast<long>(std::floor(lon_offset)), 0L, static_cast<long>(grid_cols) - 1);
+
+  /* A degree of longitude is shortest at the highest latitude on the route */
+  const double max_abs_lat = std::max(std::abs(grid_min_lat), std::abs(grid_min_lat + grid_rows * ROUTE_GRID_CELL_DEGREES));
+  const double metres_per_degree = 6371e3 * PI / DEGREES_IN_PI;
+  const double min_metres_per_cell = ROUTE_GRID_CELL_DEGREES * metres_per_degree * std::cos(max_abs_lat * PI / DEGREES_IN_PI);
+
+  const ForecastCoord query{coord.lat, coord.lon};
+  size_t best_index = 0;
+  double best_distance = std::numeric_limits<double>::max();
+  const long max_ring = static_cast<long>(std::max(grid_rows, grid_cols));
+
+  /* Search square rings of cells around the query until the ring is further than the best point */
+  for (long ring = 0; ring <= max_ring; ring++) {
+    for (long row = centre_row - ring; row <= centre_row + ring; row++) {
+      if (row < 0 || row >= static_cast<long>(grid_rows)) continue;
+      const bool edge_row = (row == centre_row - ring || row == centre_row + ring);
+      for (long col = centre_col - ring; col <= centre_col + ring; col += (edge_row ? 1 : 2 * ring)) {
+        if (col >= 0 && col < static_cast<long>(grid_cols)) {
+          const size_t cell = row * grid_cols + col;
+          for (size_t k = grid_cell_starts[cell]; k < grid_cell_starts[cell + 1]; k++) {
+            const Coord& point = route_points[grid_points[k]];
+            const double distance = get_forecast_coord_distance(query, {point.lat, point.lon});
+            if (distance < best_distance || (distance == best_distance && grid_points[k] < best_index)) {
+              best_distance = distance;
+              best_index = grid_points[k];
+            }
+          }
+        }
+        if (ring == 0) break;
+      }
+    }
+
+    /* Anything outside this ring is at least this far from the query. Keep a margin since the
+       great circle across a cell can be a little shorter than the cell's parallel */
+    const double gap_cells = std::min({lat_offset - (centre_row - ring), (centre_row + ring + 1) - lat_offset,
+                                       lon_offset - (centre_col - ring), (centre_col + ring + 1) - lon_offset});
+    if (best_distance < 0.9 * gap_cells * min_metres_per_cell) break;
+  }
+  return best_index;
+}
+
+void Route::precompute_segments() {
+  const size_t num_segments = route_points.empty() ? 0 : route_points.size() - 1;
+  segment_distances.resize(num_segments);
+  segment_angles.resize(num_segments);
+  segment_headings.assign(num_segments, Heading{});
+  cumulative_distances.assign(num_segments + 1, 0.0);
+  cumulative_climbs.assign(num_segments + 1, 0.0);
+
+  for (size_t i = 0; i < num_segments; i++) {
+    const double distance = get_distance(route_points[i], route_points[i + 1]);
+    const double alt_diff = route_points[i + 1].alt - route_points[i].alt;
+    const double angle = (distance > 0) ? asin(alt_diff / distance) : 0.0;
+
+    segment_distances[i] = distance;
+    segment_angles[i] = angle;
+
+    /* Flat earth approximation over one segment, which is at most a few hundred metres long */
+    const double mid_lat = 0.5 * (route_points[i].lat + route_points[i + 1].lat) * PI / DEGREES_IN_PI;
+    const double east = (route_points[i + 1].lon - route_points[i].lon) * cos(mid_lat);
+    const double north = route_points[i + 1].lat - route_points[i].lat;
+    const double length = sqrt(east * east + north * north);
+    if (length > 0) {
+      segment_headings[i].east = east / length;
+      segment_headings[i].north = north / length;
+    }
+    cumulative_distances[i + 1] = cumulative_distances[i] + distance;
+    cumulative_climbs[i + 1] = cumulative_climbs[i] + distance * sin(angle);
+  }
+}
+
+BatteryLut::BatteryLut(const std::string path) : BaseLut<double>(std::filesystem::path(path)) {
+  load_LUT();
+}
+
+void BatteryLut::load_LUT() {
+  std::ifstream file(lut_path);
+  RUNTIME_EXCEPTION(file.is_open(), "Battery file not found " + lut_path.string());
+
+  std::string line;
+  std::getline(file, line);
+  RUNTIME_EXCEPTION(line.rfind("soc,charge_efficiency,discharge_efficiency,internal_resistance,open_circuit_voltage", 0) == 0,
+                    "Unexpected header in Battery LUT " + lut_path.string());
+
+  /* Quantities at each state of charge, before the slopes are appended */
+  std::vector<double> socs;
+  while (std::getline(file, line)) {
+    if (line.empty() || line == "\r") continue;
+    std::stringstream line_stream(line);
+    std::string cell;
+    double fields[5];
+    for (double& field : fields) {
+      RUNTIME_EXCEPTION(std::getline(line_stream, cell, ',') && isDouble(cell),
+                        "Value " + cell + " is not a number in Battery LUT " + lut_path.string());
+      field = std::stod(cell);
+    }
+    const double charge_efficiency = fields[1];
+    const double discharge_efficiency = fields[2];
+    const double resistance = fields[3];
+    const double voltage = fields[4];
+    RUNTIME_EXCEPTION(charge_efficiency > 0 && charge_efficiency <= 1 && discharge_efficiency > 0 &&
+                      discharge_efficiency <= 1, "Efficiencies must be in (0, 1] in Battery LUT " + lut_path.string());
+    RUNTIME_EXCEPTION(resistance >= 0 && voltage > 0,
+                      "Resistance must be non-negative and voltage positive in Battery LUT " + lut_path.string());
+
+    socs.push_back(fields[0]);
+    this->values.push_back({charge_efficiency, 1.0 / discharge_efficiency, resistance / (voltage * voltage)});
+  }
+
+  this->num_rows = this->values.size();
+  this->num_cols = 2 * NUM_QUANTITIES;
+  RUNTIME_EXCEPTION(num_rows >= 2, "Battery LUT needs at least two rows " + lut_path.string());
+  soc_scale = static_cast<double>(num_rows - 1);
+  for (size_t row = 0; row < num_rows; row++) {
+    RUNTIME_EXCEPTION(std::abs(socs[row] - row / soc_scale) < 1e-9,
+                      "States of charge must be evenly spaced from 0 to 1 in Battery LUT " + lut_path.string());
+  }
+
+  /* Slope of each quantity to the next row. Lookups never start from the last row, so its slopes are zero */
+  for (size_t row = 0; row < num_rows; row++) {
+    for (size_t quantity = 0; quantity < NUM_QUANTITIES; quantity++) {
+      const double next = (row + 1 < num_rows) ? this->values[row + 1][quantity] : this->values[row][quantity];
+      this->values[row].push_back(next - this->values[row][quantity]);
+    }
+  }
+}
+
+MotorLut::MotorLut(const std::string path) : BaseLut<double>(std::filesystem::path(path)) {
+  load_LUT();
+}
+
+/* Check that breakpoints are evenly spaced and increasing. Returns the spacing */
+static double uniform_spacing(const std::vector<double>& breakpoints, const std::string& what, const std::string& path) {
+  RUNTIME_EXCEPTION(breakpoints.size() >= 2, "Need at least two " + what + " breakpoints in Motor LUT " + path);
+  const double spacing = (breakpoints.back() - breakpoints.front()) / static_cast<double>(breakpoints.size() - 1);
+  RUNTIME_EXCEPTION(spacing > 0, what + " breakpoints must increase in Motor LUT " + path);
+  for (size_t i = 0; i < breakpoints.size(); i++) {
+    RUNTIME_EXCEPTION(std::abs(breakpoints[i] - (breakpoints.front() + i * spacing)) < 1e-9 * spacing,
+                      what + " breakpoints must be evenly spaced in Motor LUT " + path);
+  }
+  return spacing;
+}
+
+void MotorLut::load_LUT() {
+  std::ifstream file(lut_path);
+  RUNTIME_EXCEPTION(file.is_open(), "Motor file not found " + lut_path.string());
+
+  std::vector<double> torques;
+  std::vector<double> speeds;
+  std::vector<std::vector<double>> efficiencies;
+
+  std::string line;
+  std::string cell;
+  std::getline(file, line);
+  std::stringstream header(line);
+  std::getline(header, cell, ',');
+  while (std::getline(header, cell, ',')) {
+    RUNTIME_EXCEPTION(isDouble(cell), "Torque " + cell + " is not a number in Motor LUT " + lut_path.string());
+    torques.push_back(std::stod(cell));
+  }
+
+  while (std::getline(file, line)) {
+    if (line.empty() || line == "\r") continue;
+    std::stringstream line_stream(line);
+    std::getline(line_stream, cell, ',');
+    RUNTIME_EXCEPTION(isDouble(cell), "Speed " + cell + " is not a number in Motor LUT " + lut_path.string());
+    speeds.push_back(std::stod(cell));
+    std::vector<double> row;
+    while (std::getline(line_stream, cell, ',')) {
+      RUNTIME_EXCEPTION(isDouble(cell), "Value " + cell + " is not a number in Motor LUT " + lut_path.string());
+      const double efficiency = std::stod(cell);
+      RUNTIME_EXCEPTION(efficiency > 0 && efficiency <= 1, "Efficiencies must be in (0, 1] in Motor LUT " + lut_path.string());
+      row.push_back(efficiency);
+    }
+    RUNTIME_EXCEPTION(row.size() == torques.size(), "Row length does not match the torques in Motor LUT " + lut_path.string());
+    efficiencies.push_back(row);
+  }
+
+  speed_min = speeds.front();
+  speed_scale = 1.0 / uniform_spacing(speeds, "Speed", lut_path.string());
+  torque_min = torques.front();
+  torque_scale = 1.0 / uniform_spacing(torques, "Torque", lut_path.string());
+  last_speed_cell = speeds.size() - 2;
+  last_torque_cell = torques.size() - 2;
+
+  this->num_rows = speeds.size() - 1;
+  this->num_cols = 4 * (torques.size() - 1);
+  this->values.assign(num_rows, std::vector<double>(num_cols));
+  max_efficiency = 0.0;
+  for (size_t i = 0; i + 1 < speeds.size(); i++) {
+    for (size_t j = 0; j + 1 < torques.size(); j++) {
+      const double f00 = efficiencies[i][j];
+      const double f01 = efficiencies[i][j + 1];
+      const double f10 = efficiencies[i + 1][j];
+      const double f11 = efficiencies[i + 1][j + 1];
+      double* c = &this->values[i][4 * j];
+      c[0] = f00;
+      c[1] = f10 - f00;
+      c[2] = f01 - f00;
+      c[3] = f11 - f10 - f01 + f00;
+    }
+  }
+  for (const std::vector<double>& row : efficiencies) {
+    max_efficiency = std::max(max_efficiency, *std::max_element(row.begin(), row.end()));
+  }
+}
+
+MotorSlice MotorLut::slice(double speed) const {
+  const double x = std::clamp((speed - speed_min) * speed_scale, 0.0, last_speed_cell + 1.0);
+  const size_t row = std::min(static_cast<size_t>(x), last_speed_cell);
+  const double dx = x - static_cast<double>(row);
+  const std::vector<double>& cells = this->values[row];
+
+  /* Along the torque axis at a fixed dx, each cell is linear: (c0 + c1 dx) + (c2 + c3 dx) dy */
+  MotorSlice motor_slice;
+  motor_slice.torque_min = torque_min;
+  motor_slice.torque_scale = torque_scale;
+  motor_slice.last_cell = last_torque_cell;
+  motor_slice.coefficients.resize(num_cols / 2);
+  for (size_t col = 0; col < num_cols / 4; col++) {
+    const double* c = &cells[4 * col];
+    motor_slice.coefficients[2 * col] = c[0] + c[1] * dx;
+    motor_slice.coefficients[2 * col + 1] = c[2] + c[3] * dx;
+  }
+  return motor_slice;
+}
+
+/* Run fn(first, step) on num_threads threads, the calling thread included, for a loop over n independent
+ * items that each call strides through as for (i = first; i < n; i += step). 0 threads uses one per
+ * hardware thread, and there are never more threads than items */
+template <typename Fn>
+static void parallel_rows(size_t n, unsigned num_threads, Fn&& fn) {
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = static_cast<unsigned>(std::min<size_t>(num_threads, std::max<size_t>(n, 1)));
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < num_threads; t++) {
+    threads.emplace_back(fn, t, num_threads);
+  }
+  fn(0, num_threads);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
 }
 
+SunGeometryLut::SunGeometryLut(const ForecastLut& forecast, unsigned num_threads) :
+    num_rows(forecast.get_num_rows()), num_cols(forecast.get_num_cols()) {
+  positions.resize(num_rows * num_cols);
+
+  std::vector<time_t> times(num_cols);
+  for (size_t col = 0; col < num_cols; col++) {
+    times[col] = forecast.get_column_time(col);
+  }
+
+  /* Each row is one batch of sun positions, at every timestamp for the row's coordinate */
+  auto fill_rows = [&](size_t first_row, size_t row_step) {
+    std::vector<double> lat(num_cols), lon(num_cols), alt(num_cols, 0.0);
+    std::vector<double> azimuth(num_cols), elevation(num_cols), east(num_cols), north(num_cols), up(num_cols);
+    for (size_t row = first_row; row < num_rows; row += row_step) {
+      const ForecastCoord& coord = forecast.get_row_coord(row);
+      std::fill(lat.begin(), lat.end(), coord.lat);
+      std::fill(lon.begin(), lon.end(), coord.lon);
+      get_az_el_batch(times, lat, lon, alt, azimuth, elevation, east, north, up);
+      for (size_t col = 0; col < num_cols; col++) {
+        SunPosition& sun = positions[row * num_cols + col];
+        sun.azimuth = azimuth[col];
+        sun.elevation = elevation[col];
+        sun.east = east[col];
+        sun.north = north[col];
+        sun.up = up[col];
+      }
+    }
+  };
+
+  parallel_rows(num_rows, num_threads, fill_rows);
+}
+
+DaylightLut::DaylightLut(const ForecastLut& forecast, unsigned num_threads) : num_rows(forecast.get_num_rows()) {
+  const size_t num_cols = forecast.get_num_cols();
+  if (num_rows == 0 || num_cols == 0) {
+    num_rows = 0;
+    return;
+  }
+
+  /* Days start from the UTC midnight a day before the first timestamp, shifted to each row's longitude,
+   * and run to at least a day after the last timestamp */
+  const time_t seconds_per_day = static_cast<time_t>(SECONDS_PER_DAY);
+  const time_t first_time = forecast.get_column_time(0);
+  const time_t last_time = forecast.get_column_time(num_cols - 1);
+  const time_t first_utc_midnight = first_time - ((first_time % seconds_per_day) + seconds_per_day) % seconds_per_day -
+                                    seconds_per_day;
+  num_days = static_cast<size_t>((last_time - first_utc_midnight) / seconds_per_day) + 3;
+  windows.resize(num_rows * num_days);
+  first_midnight.resize(num_rows);
+
+  auto fill_rows = [&](size_t first_row, size_t row_step) {
+    /* Lane 2d searches for the sunrise of day d and lane 2d + 1 for its sunset. One more lane holds the
+     * midnight ending the last day when sampling midnights and noons */
+    const size_t lanes = 2 * num_days;
+    std::vector<time_t> times(lanes + 1);
+    std::vector<double> lat(lanes + 1), lon(lanes + 1), alt(lanes + 1, 0.0), azimuth(lanes + 1), elevation(lanes + 1);
+    /* Each search keeps a time before the event (start) and one after it (end) */
+    std::vector<time_t> start(lanes), end(lanes);
+
+    for (size_t row = first_row; row < num_rows; row += row_step) {
+      const ForecastCoord& coord = forecast.get_row_coord(row);
+      std::fill(lat.begin(), lat.end(), coord.lat);
+      std::fill(lon.begin(), lon.end(), coord.lon);
+
+      /* Mean solar midnight comes 240 s earlier per degree east */
+      const time_t midnight = first_utc_midnight - static_cast<time_t>(std::lround(coord.lon * 240));
+      first_midnight[row] = midnight;
+
+      /* Sample the sun at every midnight and noon */
+      for (size_t lane = 0; lane <= lanes; lane++) {
+        times[lane] = midnight + static_cast<time_t>(lane) * (seconds_per_day / 2);
+      }
+      get_az_el_batch(times, lat, lon, alt, azimuth, elevation);
+
+      for (size_t day = 0; day < num_days; day++) {
+        const time_t day_start = times[2 * day], noon = times[2 * day + 1], day_end = times[2 * day + 2];
+        const bool risen_at_start = elevation[2 * day] > 0;
+        const bool risen_at_noon = elevation[2 * day + 1] > 0;
+        const bool risen_at_end = elevation[2 * day + 2] > 0;
+        if (!risen_at_noon) {
+          // The sun stays down all day, an empty window at noon
+          start[2 * day] = end[2 * day] = noon;
+          start[2 * day + 1] = end[2 * day + 1] = noon;
+          continue;
+        }
+        // Sunrise lies between a dark start and a light end, sunset between a light start and a dark end.
+        // If the sun is still up at midnight, the window runs to the end of the day
+        start[2 * day] = day_start;
+        end[2 * day] = risen_at_start ? day_start : noon;
+        start[2 * day + 1] = risen_at_end ? day_end : noon;
+        end[2 * day + 1] = day_end;
+      }
+
+      /* Bisect every search at once until the event is pinned to the second */
+      auto width = [&](size_t lane) { return end[lane] > start[lane] ? end[lane] - start[lane] : start[lane] - end[lane]; };
+      auto unresolved = [&]() {
+        for (size_t lane = 0; lane < lanes; lane++) {
+          if (width(lane) > 1) return true;
+        }
+        return false;
+      };
+      while (unresolved()) {
+        for (size_t lane = 0; lane < lanes; lane++) {
+          times[lane] = start[lane] + (end[lane] - start[lane]) / 2;
+        }
+        const std::span<const time_t> lane_times(times.data(), lanes);
+        get_az_el_batch(lane_times, std::span(lat).first(lanes), std::span(lon).first(lanes),
+                        std::span(alt).first(lanes), std::span(azimuth).first(lanes),
+                        std::span(elevation).first(lanes));
+        for (size_t lane = 0; lane < lanes; lane++) {
+          if (width(lane) <= 1) continue;
+          const bool risen = elevation[lane] > 0;
+          const bool after_event = (lane % 2 == 0) ? risen : !risen;
+          (after_event ? end[lane] : start[lane]) = times[lane];
+        }
+      }
+
+      for (size_t day = 0; day < num_days; day++) {
+        windows[row * num_days + day] = DaylightWindow{end[2 * day], end[2 * day + 1]};
+      }
+    }
+  };
+
+  parallel_rows(num_rows, num_threads, fill_rows);
+}
+
+SolarPositionLut::SolarPositionLut(const ForecastLut& forecast, double spacing, time_t step, unsigned num_threads) {
+  set_domain(forecast, spacing, step);
+  fill(num_threads);
+}
+
+SolarPositionLut::SolarPositionLut(const std::filesystem::path& path) {
+  RUNTIME_EXCEPTION(read(path), "Could not read solar position table " + path.string());
+}
+
+void SolarPositionLut::set_domain(const ForecastLut& forecast, double spacing, time_t step) {
+  RUNTIME_EXCEPTION(spacing > 0 && step > 0, "Solar position grid spacing and time step must be positive");
+  RUNTIME_EXCEPTION(forecast.get_num_rows() > 0 && forecast.get_num_cols() > 0,
+                    "Solar position table needs a forecast with coordinates and timestamps");
+  double max_lat = -std::numeric_limits<double>::infinity();
+  double max_lon = -std::numeric_limits<double>::infinity();
+  min_lat = std::numeric_limits<double>::infinity();
+  min_lon = std::numeric_limits<double>::infinity();
+  for (size_t row = 0; row < forecast.get_num_rows(); row++) {
+    const ForecastCoord& coord = forecast.get_row_coord(row);
+    min_lat = std::min(min_lat, coord.lat);
+    max_lat = std::max(max_lat, coord.lat);
+    min_lon = std::min(min_lon, coord.lon);
+    max_lon = std::max(max_lon, coord.lon);
+  }
+
+  /* Snap the region outwards to multiples of the spacing, and the span outwards to multiples of the step,
+   * with at least two nodes on every axis to interpolate between */
+  grid_spacing = spacing;
+  min_lat = std::floor(min_lat / spacing) * spacing;
+  min_lon = std::floor(min_lon / spacing) * spacing;
+  num_lats = std::max<size_t>(2, static_cast<size_t>(std::ceil((max_lat - min_lat) / spacing)) + 1);
+  num_lons = std::max<size_t>(2, static_cast<size_t>(std::ceil((max_lon - min_lon) / spacing)) + 1);
+
+  time_step = step;
+  const time_t first_time = forecast.get_column_time(0);
+  const time_t last_time = forecast.get_column_time(forecast.get_num_cols() - 1);
+  start_time = first_time - ((first_time % step) + step) % step;
+  num_times = std::max<size_t>(2, static_cast<size_t>((last_time - start_time + step - 1) / step) + 1);
+
+  time_scale = 1.0 / static_cast<double>(time_step);
+  grid_scale = 1.0 / grid_spacing;
+}
+
+void SolarPositionLut::fill(unsigned num_threads) {
+  const size_t num_coords = num_lats * num_lons;
+  directions.resize(3 * num_times * num_coords);
+
+  std::vector<time_t> times(num_times);
+  for (size_t t = 0; t < num_times; t++) {
+    times[t] = start_time + static_cast<time_t>(t) * time_step;
+  }
+
+  /* Each coordinate of the grid is one batch of sun positions over the whole span */
+  auto fill_coords = [&](size_t first_coord, size_t coord_step) {
+    std::vector<double> lat(num_times), lon(num_times), alt(num_times, 0.0);
+    std::vector<double> azimuth(num_times), elevation(num_times), east(num_times), north(num_times), up(num_times);
+    for (size_t coord = first_coord; coord < num_coords; coord += coord_step) {
+      std::fill(lat.begin(), lat.end(), min_lat + static_cast<double>(coord / num_lons) * grid_spacing);
+      std::fill(lon.begin(), lon.end(), min_lon + static_cast<double>(coord % num_lons) * grid_spacing);
+      get_az_el_batch(times, lat, lon, alt, azimuth, elevation, east, north, up);
+      for (size_t t = 0; t < num_times; t++) {
+        float* node = &directions[3 * (t * num_coords + coord)];
+        node[0] = static_cast<float>(east[t]);
+        node[1] = static_cast<float>(north[t]);
+        node[2] = static_cast<float>(up[t]);
+      }
+    }
+  };
+
+  parallel_rows(num_coords, num_threads, fill_coords);
+}
+
+bool SolarPositionLut::same_domain(const SolarPositionLut& other) const {
+  return start_time == other.start_time && time_step == other.time_step && min_lat == other.min_lat &&
+         min_lon == other.min_lon && grid_spacing == other.grid_spacing && num_times == other.num_times &&
+         num_lats == other.num_lats && num_lons == other.num_lons;
+}
+
+namespace {
+/* Start of a solar position table file. Bump the version whenever the layout or the solar model changes,
+ * so that stale cache files are rebuilt */
+constexpr char SOLAR_POSITION_MAGIC[8] = {'S', 'U', 'N', 'L', 'U', 'T', '0', '1'};
+
+struct SolarPositionHeader {
+  char magic[8];
+  int64_t start_time;
+  int64_t time_step;
+  double min_lat;
+  double min_lon;
+  double grid_spacing;
+  uint64_t num_times;
+  uint64_t num_lats;
+  uint64_t num_lons;
+};
+}  // namespace
+
+bool SolarPositionLut::read(const std::filesystem::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return false;
+  SolarPositionHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+  if (!std::equal(std::begin(SOLAR_POSITION_MAGIC), std::end(SOLAR_POSITION_MAGIC), header.magic)) return false;
+  if (header.time_step <= 0 || !(header.grid_spacing > 0) || header.num_times < 2 || header.num_lats < 2 ||
+      header.num_lons < 2) {
+    return false;
+  }
+
+  std::vector<float> nodes(3 * header.num_times * header.num_lats * header.num_lons);
+  if (!file.read(reinterpret_cast<char*>(nodes.data()), static_cast<std::streamsize>(nodes.size() * sizeof(float)))) {
+    return false;
+  }
+  start_time = static_cast<time_t>(header.start_time);
+  time_step = static_cast<time_t>(header.time_step);
+  min_lat = header.min_lat;
+  min_lon = header.min_lon;
+  grid_spacing = header.grid_spacing;
+  num_times = header.num_times;
+  num_lats = header.num_lats;
+  num_lons = header.num_lons;
+  time_scale = 1.0 / static_cast<double>(time_step);
+  grid_scale = 1.0 / grid_spacing;
+  directions = std::move(nodes);
+  return true;
+}
+
+bool SolarPositionLut::write(const std::filesystem::path& path) const {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) return false;
+  SolarPositionHeader header;
+  std::copy(std::begin(SOLAR_POSITION_MAGIC), std::end(SOLAR_POSITION_MAGIC), header.magic);
+  header.start_time = static_cast<int64_t>(start_time);
+  header.time_step = static_cast<int64_t>(time_step);
+  header.min_lat = min_lat;
+  header.min_lon = min_lon;
+  header.grid_spacing = grid_spacing;
+  header.num_times = num_times;
+  header.num_lats = num_lats;
+  header.num_lons = num_lons;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(directions.data()),
+             static_cast<std::streamsize>(directions.size() * sizeof(float)));
+  return static_cast<bool>(file);
+}
+
+void SolarPositionLut::save(const std::filesystem::path& path) const {
+  RUNTIME_EXCEPTION(write(path), "Could not write solar position table " + path.string());
+}
+
+std::filesystem::path SolarPositionLut::cache_path(const std::filesystem::path& forecast_path) {
+  std::filesystem::path path = forecast_path;
+  path += ".sun";
+  return path;
+}
+
+SolarPositionLut SolarPositionLut::cached(const ForecastLut& forecast, double spacing, time_t step,
+                                          unsigned num_threads) {
+  SolarPositionLut lut;
+  lut.set_domain(forecast, spacing, step);
+  const std::filesystem::path path = cache_path(forecast.get_path());
+
+  SolarPositionLut stored;
+  if (stored.read(path) && stored.same_domain(lut)) return stored;
+
+  lut.fill(num_threads);
+  lut.write(path);
+  return lut;
+}
+
+SunPosition SolarPositionLut::get_position(double lat, double lon, double time) const {
+  double direction[3];
+  interpolate(lat, lon, time, direction);
+  const double length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] +
+                                  direction[2] * direction[2]);
+
+  SunPosition sun;
+  sun.east = direction[0] / length;
+  sun.north = direction[1] / length;
+  sun.up = direction[2] / length;
+  sun.elevation = std::asin(std::clamp(sun.up, -1.0, 1.0)) * 180 / PI;
+  sun.azimuth = std::atan2(sun.east, sun.north) * 180 / PI;
+  if (sun.azimuth < 0) sun.azimuth += 360.0;
+  return sun;
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <utility>
+
+#include "Schedule.hpp"
+#include "Utils.hpp"
+
+DrivingSchedule::DrivingSchedule(std::vector<DrivingWindow> new_windows) {
+  for (const DrivingWindow& window : new_windows) {
+    if (window.end <= window.start)
+      continue;
+    RUNTIME_EXCEPTION(windows.empty() || windows.back().end <= window.start,
+                      "Driving windows must be in time order and must not overlap. Window starting " +
+                      window.start.get_local_readable_time() + " overlaps the one before it");
+    windows.push_back(window);
+  }
+
+  driving_time_from_window.assign(windows.size() + 1, 0.0);
+  for (size_t w = windows.size(); w-- > 0;) {
+    driving_time_from_window[w] = driving_time_from_window[w + 1] + (windows[w].end - windows[w].start);
+  }
+}
+
+DrivingSchedule DrivingSchedule::daily(const EpochTime& first_start, const EpochTime& first_end,
+                                       const int64_t day_start, const int64_t day_end, const EpochTime& race_end) {
+  std::vector<DrivingWindow> windows;
+  windows.push_back(DrivingWindow{first_start, std::min(first_end, race_end)});
+
+  /* Later days are offsets from the local midnight starting the first day */
+  const int64_t ms_per_day = 86400000;
+  const int64_t first_ms = first_start.get_local_milliseconds();
+  const int64_t first_midnight_ms = first_ms - ((first_ms % ms_per_day) + ms_per_day) % ms_per_day;
+  const double utc_adjustment = static_cast<double>(first_start.get_utc_milliseconds() - first_ms) / 3600000.0;
+  for (int64_t midnight_ms = first_midnight_ms + ms_per_day;; midnight_ms += ms_per_day) {
+    const EpochTime start(midnight_ms + day_start * 1000, utc_adjustment);
+    if (start >= race_end)
+      break;
+    const EpochTime end(midnight_ms + day_end * 1000, utc_adjustment);
+    windows.push_back(DrivingWindow{start, std::min(end, race_end)});
+  }
+  return DrivingSchedule(std::move(windows));
+}
+
+double DrivingSchedule::driving_time_left(const EpochTime& time) const {
+  /* First window still open at the time */
+  const auto window = std::upper_bound(windows.begin(), windows.end(), time,
+                                       [](const EpochTime& t, const DrivingWindow& w) { return t < w.end; });
+  if (window == windows.end())
+    return 0.0;
+  const size_t w = static_cast<size_t>(window - windows.begin());
+  return (window->end - std::max(time, window->start)) + driving_time_from_window[w + 1];
+}
+
+ScheduleCursor::ScheduleCursor(const DrivingSchedule& schedule, const EpochTime& time) : schedule(&schedule) {
+  reset(time);
+}
+
+int64_t ScheduleCursor::boundary_ms(const size_t index) const {
+  if (!schedule || index >= 2 * schedule->windows.size())
+    return NO_BOUNDARY;
+  const DrivingWindow& window = schedule->windows[index / 2];
+  return (index % 2 == 0 ? window.start : window.end).get_local_milliseconds();
+}
+
+void ScheduleCursor::walk(const int64_t time_ms) {
+  while (time_ms >= next_boundary_ms) {
+    boundary++;
+    next_boundary_ms = boundary_ms(boundary);
+  }
+}
+
+void ScheduleCursor::reset(const EpochTime& time) {
+  boundary = 0;
+  next_boundary_ms = boundary_ms(0);
+  if (!schedule)
+    return;
+
+  /* Boundaries are sorted, so count the ones at or before the time by searching the window ends */
+  const std::vector<DrivingWindow>& windows = schedule->windows;
+  const auto window = std::upper_bound(windows.begin(), windows.end(), time,
+                                       [](const EpochTime& t, const DrivingWindow& w) { return t < w.end; });
+  boundary = 2 * static_cast<size_t>(window - windows.begin());
+  next_boundary_ms = boundary_ms(boundary);
+  walk(time.get_local_milliseconds());
+}
@@ -2,143 +2,491 @@
 #include <vector>
 #include <unordered_set>
 #include <limits>
+#include <cmath>
 #include <utility>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "Sim.hpp"
 #include "Utils.hpp"
 #include "Car.hpp"
 
-Simulator::Simulator(std::shared_ptr<Car> model, const Coord starting_coord,
-                     const Time starting_time) : car(model), starting_coord(starting_coord),
-                                                 curr_time(starting_time) {}
+template <typename CarType>
+BasicSimulator<CarType>::BasicSimulator(std::shared_ptr<CarType> model, const Coord starting_coord,
+                     const EpochTime starting_time) : starting_coord(starting_coord), starting_time(starting_time),
+                                                 car(model),
+                                                 schedule(DrivingSchedule::daily(day_one_start_time, day_one_end_time,
+                                                                                 day_start_time, day_end_time,
+                                                                                 race_end_time)) {
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::set_schedule(DrivingSchedule new_schedule) {
+  RUNTIME_EXCEPTION(!new_schedule.empty(), "A driving schedule needs at least one window");
+  schedule = std::move(new_schedule);
+}
           
+void PowerCache::clear() {
+  for (Slot& slot : slots) {
+    slot.valid = false;
+  }
+}
+
+const char* sim_failure_name(const SimFailure failure) {
+  switch (failure) {
+    case SimFailure::None: return "none";
+    case SimFailure::Deadline: return "deadline";
+    case SimFailure::Energy: return "energy";
+  }
+  return "unknown";
+}
+
+ForecastTables make_forecast_tables(std::shared_ptr<const ForecastLut> forecast) {
+  ForecastTables tables;
+  tables.forecast = forecast;
+  tables.sun_geometry = std::make_shared<const SunGeometryLut>(*forecast);
+  tables.array_irradiance = std::make_shared<const ForecastLut>(forecast->with_incidence(*tables.sun_geometry));
+  tables.daylight = std::make_shared<const DaylightLut>(*forecast);
+  return tables;
+}
+
 // Write your implementation here
 
-bool Simulator::run_sim(const double speed) {
+template <typename CarType>
+void BasicSimulator<CarType>::set_control_stops(std::unordered_set<size_t> stops) {
+  control_stops = stops;
+  build_stretches();
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::set_route(Route new_route) {
+  set_route(std::make_shared<const Route>(std::move(new_route)));
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::set_route(std::shared_ptr<const Route> new_route) {
+  route = new_route;
+  index_route_forecast();
+  build_stretches();
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::set_forecast_lut(ForecastLut new_forecast_lut) {
+  set_forecast_lut(std::make_shared<const ForecastLut>(std::move(new_forecast_lut)));
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::set_forecast_lut(std::shared_ptr<const ForecastLut> new_forecast_lut) {
+  set_forecast_tables(make_forecast_tables(new_forecast_lut));
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::set_forecast_tables(const ForecastTables& tables) {
+  RUNTIME_EXCEPTION(tables.forecast && tables.sun_geometry && tables.array_irradiance && tables.daylight,
+                    "Forecast tables must all be set, e.g. by make_forecast_tables");
+  forecast_lut = tables.forecast;
+  sun_geometry = tables.sun_geometry;
+  array_irradiance = tables.array_irradiance;
+  daylight = tables.daylight;
+  index_weather_channels();
+  index_route_forecast();
+}
+
+template <typename CarType>
+ForecastTables BasicSimulator<CarType>::get_forecast_tables() const {
+  return ForecastTables{forecast_lut, sun_geometry, array_irradiance, daylight};
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::index_weather_channels() {
+  const size_t num_channels = forecast_lut->get_num_channels();
+  wind_east_channel = forecast_lut->find_channel(WIND_EAST_CHANNEL);
+  wind_north_channel = forecast_lut->find_channel(WIND_NORTH_CHANNEL);
+  temperature_channel = forecast_lut->find_channel(TEMPERATURE_CHANNEL);
+  has_wind = wind_east_channel < num_channels && wind_north_channel < num_channels;
+  has_temperature = temperature_channel < num_channels;
+
+  max_wind_speed = 0.0;
+  if (has_wind) {
+    const auto [min_east, max_east] = forecast_lut->get_channel_range(wind_east_channel);
+    const auto [min_north, max_north] = forecast_lut->get_channel_range(wind_north_channel);
+    const double east = std::max(std::abs(min_east), std::abs(max_east));
+    const double north = std::max(std::abs(min_north), std::abs(max_north));
+    max_wind_speed = sqrt(east * east + north * north);
+  }
+  min_density_ratio = 1.0;
+  max_density_ratio = 1.0;
+  if (has_temperature) {
+    const auto [min_temperature, max_temperature] = forecast_lut->get_channel_range(temperature_channel);
+    min_density_ratio = air_density_ratio(max_temperature);
+    max_density_ratio = air_density_ratio(min_temperature);
+  }
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::index_route_forecast() {
+  route_forecast_rows.reset();
+  if (!route || !forecast_lut || route->get_route_points().empty() || forecast_lut->get_num_rows() == 0)
+    return;
+
+  const std::vector<Coord>& points = route->get_route_points();
+  std::vector<size_t> rows(points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    rows[i] = forecast_lut->find_row({points[i].lat, points[i].lon});
+  }
+  route_forecast_rows = std::make_shared<const std::vector<size_t>>(std::move(rows));
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::set_start(const Coord& coord, const EpochTime& time, const double soc) {
+  RUNTIME_EXCEPTION(soc >= 0.0 && soc <= 1.0, "State of charge must be between 0 and 1");
+  starting_coord = coord;
+  starting_time = time;
+  starting_soc = soc;
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::build_stretches() {
+  stretch_aggregates.clear();
+  const size_t num_points = route ? route->get_route_points().size() : 0;
+  if (num_points < 2)
+    return;
+
+  std::vector<size_t> boundaries(control_stops.begin(), control_stops.end());
+  std::sort(boundaries.begin(), boundaries.end());
+  size_t from = 0;
+  for (const size_t stop : boundaries) {
+    if (stop <= from || stop >= num_points - 1)
+      continue;
+    stretch_aggregates.push_back(route->get_aggregate(from, stop));
+    from = stop;
+  }
+  stretch_aggregates.push_back(route->get_aggregate(from, num_points - 1));
+}
+
+template <typename CarType>
+std::vector<double> BasicSimulator<CarType>::estimate_stretch_energies(const double speed) const {
+  RUNTIME_EXCEPTION(car != nullptr, "Car is null");
+  std::vector<double> energies;
+  energies.reserve(stretch_aggregates.size());
+  for (const RouteAggregate& stretch : stretch_aggregates) {
+    energies.push_back(car->drive_energy(speed, stretch));
+  }
+  return energies;
+}
+
+template <typename CarType>
+SimResult BasicSimulator<CarType>::run_sim(const double speed) {
+  RUNTIME_EXCEPTION(route_forecast_rows != nullptr, "Route and forecast must both be set before simulating");
+  const size_t num_points = route->get_route_points().size();
+  RUNTIME_EXCEPTION(num_points >= 2, "Route needs at least two points");
+
+  SimCheckpoint start;
+  start.route_index = route->find_nearest_point(starting_coord);
+  start.segment_distance_left = (start.route_index + 1 < num_points) ? route->get_segment_distance(start.route_index) : 0.0;
+  start.control_stop_pending = false;
+  start.time = starting_time;
+  start.battery_energy = starting_soc * battery_capacity;
+  start.cursor.row = (*route_forecast_rows)[start.route_index];
+  start.cursor.column = forecast_lut->find_column(start.time.get_utc_time_point());
+
+  start.progress.min_battery_energy = start.battery_energy;
+  start.progress.min_soc = starting_soc;
+  start.progress.min_soc_index = start.route_index;
+  start.progress.min_soc_time = start.time;
+
+  checkpoints.clear();
+  return simulate(start, speed);
+}
+
+template <typename CarType>
+SimResult BasicSimulator<CarType>::resume_sim(const SimCheckpoint& checkpoint, const double speed) {
+  RUNTIME_EXCEPTION(route_forecast_rows != nullptr, "Route and forecast must both be set before simulating");
+  RUNTIME_EXCEPTION(checkpoint.route_index < route->get_route_points().size(), "Checkpoint is not on the route");
+
+  // The resumed run records this checkpoint again, along with everything after it
+  while (!checkpoints.empty() && checkpoints.back().time >= checkpoint.time) {
+    checkpoints.pop_back();
+  }
+  return simulate(checkpoint, speed);
+}
+
+template <typename CarType>
+void BasicSimulator<CarType>::invalidate_checkpoints_after(const EpochTime& time) {
+  if (!forecast_lut) {
+    checkpoints.clear();
+    return;
+  }
+  const time_t changed_from = time.get_utc_time_point();
+  while (!checkpoints.empty() &&
+         (checkpoints.back().time.get_utc_time_point() >= changed_from ||
+          forecast_lut->get_column_time(checkpoints.back().cursor.column) >= changed_from)) {
+    checkpoints.pop_back();
+  }
+}
+
+template <typename CarType>
+SimResult BasicSimulator<CarType>::simulate(SimCheckpoint state, const double speed) {
   RUNTIME_EXCEPTION(car != nullptr, "Car is null");
+  RUNTIME_EXCEPTION(route_forecast_rows != nullptr, "Route and forecast must both be set before simulating");
+  const std::vector<size_t>& forecast_rows = *route_forecast_rows;
 
-  curr_time = day_one_start_time;
-  const double battery_capacity = 5.2 * 3600 * 1000; // 5.2 kWh in Joules
-  double battery_energy = battery_capacity;
+  SimResult& result = state.progress;
 
   // Load route points.
-  const std::vector<Coord>& points = route.get_route_points();
+  const std::vector<Coord>& points = route->get_route_points();
   size_t num_points = points.size();
 
-  Time finish_deadline("2023-10-28 17:00:00", -9.5);
-
   // Constants
-  const double array_area = 4.0;
-  const double array_efficiency = 0.252;
-  const double battery_efficiency = 0.98;
   const double EPS = 1e-6;
+  // Battery power delivered per unit of irradiance
+  const double stationary_gain = car->get_power_coefficients().solar;
+  // Battery model of the car. Without one the battery is an ideal store behind stationary_gain
+  const BatteryLut* battery = car->get_battery();
+  // Power at the battery terminals per unit of irradiance, for the battery model
+  const double array_gain = car->get_power_coefficients().array;
+  // The speed is constant, so a motor map only needs its torque axis at this speed
+  MotorSlice motor_slice;
+  if (car->get_motor())
+    motor_slice = car->motor_slice(speed);
+  const MotorSlice* motor = car->get_motor() ? &motor_slice : nullptr;
+  // The car, its tables or its motor slice may have changed since the last run
+  power_cache.clear();
+  const EpochTime race_start = schedule.get_start();
+  const EpochTime race_end = schedule.get_end();
+  const double race_end_utc = race_end.get_utc_time_point();
 
-  // Returns true if t is within allowed driving hours.
-  auto is_driving_time = [&](const Time &t) -> bool {
-    tm tm_local = t.m_datetime_local;
-    int hour = tm_local.tm_hour, day = tm_local.tm_mday;
-    int month = tm_local.tm_mon + 1, year = tm_local.tm_year + 1900;
-    if (year == 2023 && month == 10) {
-      if (day == 22)
-        return (hour >= 10 && hour < 18);
-      else if (day >= 23 && day <= 28)
-        return (hour >= 9 && hour < 17);
-    }
-    return false;
+  // Driving windows. Simulation time only moves forward, so queries are usually a single comparison.
+  ScheduleCursor windows(schedule, state.time);
+
+  // Returns the forecast cell at the current route point and time. Channel 0 is the irradiance on the array.
+  auto get_cell = [&]() -> const double* {
+    state.cursor.row = forecast_rows[state.route_index];
+    array_irradiance->advance_column(state.cursor, state.time.get_utc_time_point());
+    return array_irradiance->get_cell(state.cursor);
   };
 
-  // Returns seconds until the next driving window.
-  auto time_until_driving_start = [&](const Time &t) -> double {
-    tm tm_local = t.m_datetime_local;
-    double current_seconds = tm_local.tm_hour * 3600 + tm_local.tm_min * 60 + tm_local.tm_sec;
-    double start_seconds = 0;
-    int day = tm_local.tm_mday, month = tm_local.tm_mon + 1, year = tm_local.tm_year + 1900;
-    if (year == 2023 && month == 10)
-      start_seconds = (day == 22) ? 10 * 3600 : 9 * 3600;
-    if (current_seconds < start_seconds)
-      return start_seconds - current_seconds;
-    return 24 * 3600 - current_seconds + 9 * 3600;
+  // Returns the headwind along the current segment in a forecast cell, or 0 without wind channels.
+  auto get_headwind = [&](const double* cell) -> double {
+    if (!has_wind)
+      return 0.0;
+    const Heading& heading = route->get_segment_heading(state.route_index);
+    return -(cell[wind_east_channel] * heading.east + cell[wind_north_channel] * heading.north);
   };
 
-  // Returns the remaining driving time in the current window.
-  auto driving_time_remaining = [&](const Time &t) -> double {
-    tm tm_local = t.m_datetime_local;
-    double current_seconds = tm_local.tm_hour * 3600 + tm_local.tm_min * 60 + tm_local.tm_sec;
-    double end_seconds = 0;
-    int day = tm_local.tm_mday, month = tm_local.tm_mon + 1, year = tm_local.tm_year + 1900;
-    if (year == 2023 && month == 10)
-      end_seconds = (day == 22) ? 18 * 3600 : 17 * 3600;
-    return (end_seconds > current_seconds) ? (end_seconds - current_seconds) : 0;
+  // Returns the air density ratio in a forecast cell, or 1 without a temperature channel.
+  auto get_density_ratio = [&](const double* cell) -> double {
+    return has_temperature ? air_density_ratio(cell[temperature_channel]) : 1.0;
   };
 
-  // Returns current UTC time (for irradiance lookup).
-  auto get_epoch = [&]() -> time_t {
-    return curr_time.t_datetime_utc;
+  // Lower bound on the drag at this speed relative to still air at the reference density, over any
+  // headwind or tailwind up to the strongest wind and any air density in the forecast.
+  const double slowest_air_speed = speed - max_wind_speed;
+  const double drag_bound = slowest_air_speed * std::abs(slowest_air_speed) / (speed * speed);
+  const double aero_scale_bound = drag_bound * (drag_bound >= 0 ? min_density_ratio : max_density_ratio);
+
+  // Returns the current UTC time in seconds, including milliseconds.
+  auto utc_seconds = [&]() -> double {
+    return race_start.get_utc_time_point() + (state.time - race_start);
   };
 
   // Returns true if the finish deadline is exceeded.
   auto check_deadline = [&]() -> bool {
-    return (curr_time > finish_deadline);
+    return (state.time > race_end);
+  };
+
+  // Applies an energy change to the battery, clamping at capacity and tracking the lowest charge.
+  auto apply_energy = [&](const double delta) {
+    state.battery_energy += delta;
+    if (state.battery_energy > battery_capacity) {
+      result.clipped_energy += state.battery_energy - battery_capacity;
+      state.battery_energy = battery_capacity;
+    }
+    if (state.battery_energy < result.min_battery_energy) {
+      result.min_battery_energy = state.battery_energy;
+      result.min_soc = state.battery_energy / battery_capacity;
+      result.min_soc_index = state.route_index;
+      result.min_soc_time = state.time;
+    }
+  };
+
+  // Charges the battery from the array while stationary for a duration starting now. The race only
+  // allows charging while the sun is above the horizon, so the dark part of the period is skipped.
+  auto charge_stationary = [&](const double duration) {
+    const double start = utc_seconds();
+    const size_t row = forecast_rows[state.route_index];
+    if (!battery) {
+      double energy = 0.0;
+      daylight->for_each_daylight(row, start, start + duration, [&](const double from, const double to) {
+        energy += array_irradiance->get_integral(row, from, to) * stationary_gain;
+      });
+      result.solar_energy += energy;
+      apply_energy(energy);
+      return;
+    }
+    // The battery's efficiency and resistive loss follow its charge, so step through the daylight at the
+    // mean array power of each step
+    daylight->for_each_daylight(row, start, start + duration, [&](const double from, const double to) {
+      for (double offset = 0; offset < to - from; offset += CHARGING_STEP_SIZE) {
+        const double step = std::min<double>(CHARGING_STEP_SIZE, to - from - offset);
+        const double terminal = array_gain * array_irradiance->get_integral(row, from + offset, from + offset + step) / step;
+        const double energy = battery->stored_power(terminal, state.battery_energy / battery_capacity) * step;
+        result.solar_energy += energy;
+        apply_energy(energy);
+      }
+    });
+  };
+
+  // Saves the current state before serving a stop.
+  auto record_checkpoint = [&]() {
+    state.cursor.row = forecast_rows[state.route_index];
+    array_irradiance->advance_column(state.cursor, state.time.get_utc_time_point());
+    checkpoints.push_back(state);
+  };
+
+  // Fills in the remaining result fields once the run has ended.
+  auto finish = [&](const SimFailure failure) -> SimResult {
+    result.feasible = failure == SimFailure::None;
+    result.failure = failure;
+    result.finish_time = state.time;
+    result.elapsed_seconds = state.time - race_start;
+    result.final_battery_energy = state.battery_energy;
+    return result;
   };
 
   // Process each route segment.
-  for (size_t i = 0; i < num_points - 1; i++) {
+  while (true) {
+    // If the car has arrived at a control stop, pause for 30 minutes with charging.
+    if (state.control_stop_pending) {
+      record_checkpoint();
+      double stop_duration = control_stop_charge_time;
+      charge_stationary(stop_duration);
+      state.time = state.time + stop_duration;
+      state.control_stop_pending = false;
+      if (check_deadline())
+        return finish(SimFailure::Deadline);
+    }
+
+    const size_t i = state.route_index;
+    if (i + 1 >= num_points)
+      break;
     if (check_deadline())
-      return false;
-    const Coord &curr_point = points[i];
-    const Coord &next_point = points[i + 1];
-    double segment_distance = get_distance(curr_point, next_point);
-    double alt_diff = next_point.alt - curr_point.alt;
-    double angle = (segment_distance > 0) ? asin(alt_diff / segment_distance) : 0.0;
-    double remaining_distance = segment_distance;
+      return finish(SimFailure::Deadline);
+
+    // Give up as soon as the run is provably doomed. The clock drops sub-millisecond remainders, so
+    // the simulation can squeeze out slightly more time than the ideal; allow for that before
+    // declaring a run infeasible. Solar gain is bounded by the brightest forecast cell at each time,
+    // which also covers irradiance sampled at the start of a driving step and held for the rest of
+    // it. A battery model stores at most the terminal power when charging and draws at least the
+    // terminal power when discharging, so for it the bound takes the array output at the terminals.
+    double angle = route->get_segment_angle(i);
+    const double rounding_slack = 2e-3 * (num_points - i);
+    RouteAggregate route_left = route->get_remaining_aggregate(i + 1);
+    route_left.distance += state.segment_distance_left;
+    route_left.climb += state.segment_distance_left * sin(angle);
+    route_left.segments++;
+    if (route_left.distance / speed > windows.driving_time_left(state.time) + rounding_slack)
+      return finish(SimFailure::Deadline);
+    const double solar_bound = (battery ? array_gain : stationary_gain) * array_irradiance->get_upper_bound_integral(utc_seconds(), race_end_utc + rounding_slack);
+    const double energy_needed = car->drive_energy(speed, route_left, aero_scale_bound);
+    // The energy bound sums the rest of the route from aggregates in a different order than the
+    // steps will, so the two can differ by rounding. 1 J is far above that error and far below the
+    // energy of a single step, so it only keeps a run on the edge of feasible from being cut short
+    if (state.battery_energy + solar_bound < energy_needed - 1.0)
+      return finish(SimFailure::Energy);
 
     // Drive the segment until finished.
-    while (remaining_distance > EPS) {
+    while (state.segment_distance_left > EPS) {
       if (check_deadline())
-        return false;
-      if (!is_driving_time(curr_time)) {
-        double wait_time = time_until_driving_start(curr_time);
-        double irradiance = forecast_lut.get_value({curr_point.lat, curr_point.lon}, get_epoch());
-        double stationary_net_power = irradiance * array_area * array_efficiency * battery_efficiency;
-        battery_energy += stationary_net_power * wait_time;
-        if (battery_energy > battery_capacity)
-          battery_energy = battery_capacity;
-        curr_time = curr_time + wait_time;
+        return finish(SimFailure::Deadline);
+      if (!windows.is_driving(state.time)) {
+        double wait_time = windows.time_until_start(state.time);
+        // Past the last window the race is over
+        if (std::isinf(wait_time))
+          return finish(SimFailure::Deadline);
+        record_checkpoint();
+        charge_stationary(wait_time);
+        state.time = state.time + wait_time;
         if (check_deadline())
-          return false;
+          return finish(SimFailure::Deadline);
         continue;
       }
-      double avail_time = driving_time_remaining(curr_time);
-      double travel_time = std::min(avail_time, remaining_distance / speed);
-      double irradiance = forecast_lut.get_value({curr_point.lat, curr_point.lon}, get_epoch());
-      double net_power = car->energy_consumption(speed, angle, irradiance);
-      battery_energy += net_power * travel_time;
-      if (battery_energy > battery_capacity)
-        battery_energy = battery_capacity;
-      curr_time = curr_time + travel_time;
-      remaining_distance -= speed * travel_time;
-    }
-    // If a control stop is scheduled at the next point, pause for 30 minutes with charging.
-    if (control_stops.find(i + 1) != control_stops.end()) {
-      double stop_duration = 30 * 60;
-      double irradiance = forecast_lut.get_value({points[i + 1].lat, points[i + 1].lon}, get_epoch());
-      double stationary_net_power = irradiance * array_area * array_efficiency * battery_efficiency;
-      battery_energy += stationary_net_power * stop_duration;
-      if (battery_energy > battery_capacity)
-        battery_energy = battery_capacity;
-      curr_time = curr_time + stop_duration;
-      if (check_deadline())
-        return false;
+      double avail_time = windows.time_left_in_window(state.time);
+      double travel_time = std::min(avail_time, state.segment_distance_left / speed);
+      const double* cell = get_cell();
+      double irradiance = cell[0];
+      double headwind = get_headwind(cell);
+      double density_ratio = get_density_ratio(cell);
+      double net_power, solar_power, load_power;
+      const PowerCache::Key key{speed, angle, irradiance, headwind, density_ratio};
+      if (battery) {
+        const double terminal = power_cache.get(key, [&] {
+          return car->terminal_power(speed, angle, irradiance, headwind, density_ratio, motor);
+        });
+        solar_power = array_gain * irradiance;
+        load_power = solar_power - terminal;
+        net_power = battery->stored_power(terminal, state.battery_energy / battery_capacity);
+      } else {
+        net_power = power_cache.get(key, [&] {
+          return car->energy_consumption(speed, angle, irradiance, headwind, density_ratio, motor);
+        });
+        solar_power = stationary_gain * irradiance;
+        load_power = solar_power - net_power;
+      }
+      result.drive_energy += load_power * travel_time;
+      result.solar_energy += solar_power * travel_time;
+      apply_energy(net_power * travel_time);
+      state.time = state.time + travel_time;
+      state.segment_distance_left -= speed * travel_time;
+      if (state.battery_energy < 0)
+        return finish(SimFailure::Energy);
     }
+
+    // Arrive at the next point.
+    state.route_index = i + 1;
+    state.segment_distance_left = (i + 2 < num_points) ? route->get_segment_distance(i + 1) : 0.0;
+    state.control_stop_pending = control_stops.find(i + 1) != control_stops.end();
   }
 
-  // Final output: if simulation finished before the deadline and battery never went negative.
-  if (check_deadline() || battery_energy < 0) {
-    std::cout << "Did not finish." << std::endl;
-    return false;
-  } else {
-    double finish_time_sec = curr_time - day_one_start_time; // returns seconds.
-    std::cout << "Finished in " << finish_time_sec << " seconds." << std::endl;
-    return true;
+  // Final result: viable if the simulation finished before the deadline and the battery is not empty.
+  if (check_deadline())
+    return finish(SimFailure::Deadline);
+  if (state.battery_energy < 0)
+    return finish(SimFailure::Energy);
+  return finish(SimFailure::None);
+}
+
+template class BasicSimulator<Car>;
+template class BasicSimulator<ProductionCar>;
+
+std::vector<std::vector<SimResult>> run_car_batch(const Simulator& base, const std::vector<CarParams>& cars,
+                                                  const std::vector<double>& speeds, unsigned num_threads) {
+  std::vector<std::vector<SimResult>> results(cars.size());
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min<unsigned>(num_threads, std::max<size_t>(cars.size(), 1));
+
+  // Workers take the next car until none are left. Each writes only its own cars' results
+  std::atomic<size_t> next_car{0};
+  auto worker = [&]() {
+    Simulator simulator(base);
+    for (size_t c = next_car++; c < cars.size(); c = next_car++) {
+      simulator.set_car(std::make_shared<Car>(cars[c]));
+      results[c].reserve(speeds.size());
+      for (const double speed : speeds) {
+        results[c].push_back(simulator.run_sim(speed));
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < num_threads; t++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
   }
+  return results;
 }
@@ -1,5 +1,59 @@
 #include "Utils.hpp"
+#include <algorithm>
 #include <cmath>
+#include <limits>
+
+SimdLevel detect_simd_level() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  static const SimdLevel level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+    return SimdLevel::Scalar;
+  }();
+  return level;
+#else
+  return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel clamp_simd_level(const SimdLevel requested) {
+  const SimdLevel supported = detect_simd_level();
+  return static_cast<int>(requested) > static_cast<int>(supported) ? supported : requested;
+}
+
+const char* simd_level_name(const SimdLevel level) {
+  switch (level) {
+    case SimdLevel::Scalar: return "scalar";
+    case SimdLevel::Avx2: return "avx2";
+    case SimdLevel::Avx512: return "avx512";
+  }
+  return "unknown";
+}
+
+double largest_cubic_root(double a, double p, double q) {
+  RUNTIME_EXCEPTION(a > 0, "Cubic coefficient must be positive");
+  // Monic form x^3 + P x + Q = 0
+  const double P = p / a;
+  const double Q = q / a;
+  const double discriminant = Q * Q / 4 + P * P * P / 27;
+
+  double x;
+  if (discriminant > 0) {
+    // One real root. Take the cube root of the larger term so the two terms cannot cancel
+    const double u = cbrt(-Q / 2 - std::copysign(sqrt(discriminant), Q));
+    x = (u != 0) ? u - P / (3 * u) : 0.0;
+  } else {
+    // Three real roots, P <= 0. The largest is 2r cos(theta / 3)
+    const double r = sqrt(-P / 3);
+    const double cos_theta = (r > 0) ? std::clamp(-Q / (2 * r * r * r), -1.0, 1.0) : 1.0;
+    x = 2 * r * cos(acos(cos_theta) / 3);
+  }
+
+  const double slope = 3 * x * x + P;
+  if (slope > 0) x -= (x * x * x + P * x + Q) / slope;
+  return (x > 0) ? x : std::numeric_limits<double>::quiet_NaN();
+}
 
 bool isDouble(std::string str) {
 	if (str[0] == '-' && str.size() >= 2) {
@@ -58,26 +112,8 @@ double get_forecast_coord_distance(ForecastCoord src_coord, ForecastCoord dst_co
 }
 
 double julian_day(time_t utc_time_point) {
-  // Extract UTC Time
-  struct tm tm;
-  LOCALTIME_SAFE(&utc_time_point, &tm);
-  double year = tm.tm_year + 1900;
-  double month = tm.tm_mon + 1;
-  double day = tm.tm_mday;
-  double hour = tm.tm_hour;
-  double min = tm.tm_min;
-  double sec = tm.tm_sec;
-
-  if (month <= 2) {
-    year -= 1;
-    month += 12;
-  }
-
-  double jd = floor(365.25*(year + 4716.0)) + floor(30.6001*(month + 1.0)) + 2.0 -
-              floor(year / 100.0) + floor(floor(year / 100.0) / 4.0) + day - 1524.5 +
-              (hour + min / 60 + sec / 3600) / 24;
-
-  return jd;
+  // The epoch began at midnight UTC, half a day into julian day 2440587
+  return static_cast<double>(utc_time_point) / SECONDS_PER_DAY + UNIX_EPOCH_JULIAN_DAY;
 }
 
 
@@ -133,12 +169,9 @@ void get_az_el(time_t utc_time_point, double Lat, double Lon, double Alt, double
   // hourvec = datevec(UTC);
   // UTH = hourvec(:, 4) + hourvec(:, 5) / 60 + hourvec(:, 6) / 3600;
 
-  // Get UTC representation of time / C++ Specific
-  tm tm_obj;
-  tm *ptm = &tm_obj;
-  GMTIME_SAFE(&utc_time_point, ptm);
-  double UTH = static_cast<double>(ptm->tm_hour) + static_cast<double>(ptm->tm_min) / 60 +
-               static_cast<double>(ptm->tm_sec / 3600);
+  // Hours since UTC midnight / C++ Specific
+  const time_t seconds_of_day = ((utc_time_point % 86400) + 86400) % 86400;
+  double UTH = static_cast<double>(seconds_of_day) / 3600;
 
   // Calculate local siderial time
   double GMST0 = fmod(L + 180, 360.0) / 15;
@@ -164,3 +197,242 @@ void get_az_el(time_t utc_time_point, double Lat, double Lon, double Alt, double
   *Az = atan2(yhor, xhor)*(180 / PI) + 180;
   *El = asin(zhor)*(180 / PI);
 }
+
+/* The batch solar position kernel is plain C++ for the compiler to vectorize, at the width of the
+   calling wrapper's target. libm calls would stop vectorization, so it brings its own trig, and
+   replaces every angle that is only fed back into trig by its sine and cosine */
+namespace {
+
+/* Nearest integer to x, for |x| < 2^51, by adding and subtracting 1.5 * 2^52. Compiles to two adds
+   wherever std::floor would be a libm call */
+__attribute__((always_inline))
+inline double round_to_integer(const double x) {
+  const double shift = 6755399441055744.0;
+  return (x + shift) - shift;
+}
+
+/* Cosine of an angle in [-45, 45] degrees, by the same Taylor series sincos_degrees uses after reducing
+   its angle. Branch free */
+__attribute__((always_inline))
+inline double cos_degrees_reduced(const double degrees) {
+  const double t = degrees * (PI / 180);
+  const double t2 = t * t;
+  return 1 + t2 * (-1.0 / 2 + t2 * (1.0 / 24 + t2 * (-1.0 / 720 + t2 * (1.0 / 40320 +
+         t2 * (-1.0 / 3628800 + t2 * (1.0 / 479001600 + t2 * (-1.0 / 87178291200 +
+         t2 * (1.0 / 20922789888000 + t2 * (-1.0 / 6402373705728000)))))))));
+}
+
+/* Sine and cosine of an angle in degrees. The angle is reduced to [-45, 45] degrees, exactly for any
+   angle the solar model produces, where Taylor series to the 17th and 18th power are accurate to
+   rounding. Branch free */
+__attribute__((always_inline))
+inline void sincos_degrees(const double degrees, double* sin_out, double* cos_out) {
+  const double quadrant = round_to_integer(degrees * (1.0 / 90));
+  const double t = (degrees - quadrant * 90) * (PI / 180);
+  const double t2 = t * t;
+  const double s = t + t * t2 * (-1.0 / 6 + t2 * (1.0 / 120 + t2 * (-1.0 / 5040 + t2 * (1.0 / 362880 +
+                   t2 * (-1.0 / 39916800 + t2 * (1.0 / 6227020800 + t2 * (-1.0 / 1307674368000 +
+                   t2 * (1.0 / 355687428096000))))))));
+  const double c = cos_degrees_reduced(degrees - quadrant * 90);
+
+  /* Quadrant modulo 4 picks which of s and c to use and their signs. quadrant / 4 - 0.375 rounds to
+     floor(quadrant / 4) */
+  const double q = quadrant - 4 * round_to_integer(quadrant / 4 - 0.375);
+  const bool odd = q == 1 || q == 3;
+  const double sin_value = odd ? c : s;
+  const double cos_value = odd ? s : c;
+  *sin_out = q >= 2 ? -sin_value : sin_value;
+  *cos_out = (q == 1 || q == 2) ? -cos_value : cos_value;
+}
+
+/* atan2 in degrees. The ratio of the smaller to the larger of |y| and |x| is reduced as in the Cephes
+   library's atan, whose rational approximation is accurate to rounding. Branch free */
+__attribute__((always_inline))
+inline double atan2_degrees(const double y, const double x) {
+  const double ax = std::abs(x);
+  const double ay = std::abs(y);
+  /* Every step is arithmetic on selected constants, so loops calling this have no branches */
+  const double smaller = std::min(ax, ay);
+  const double larger = std::max(std::max(ax, ay), std::numeric_limits<double>::min());
+
+  /* Above tan(33.4 degrees), use atan(a) = pi/4 + atan((a - 1) / (a + 1)), for a = smaller / larger */
+  const double reduced = smaller > 0.66 * larger ? 1.0 : 0.0;
+  const double u = (smaller - reduced * larger) / (larger + reduced * smaller);
+  const double z = u * u;
+  const double p = (((-8.750608600031904122785e-1 * z - 1.615753718733365076637e1) * z -
+                     7.500855792314704667340e1) * z - 1.228866684490136173410e2) * z - 6.485021904942025371773e1;
+  const double q = ((((z + 2.485846490142306297962e1) * z + 1.650270098316988542046e2) * z +
+                     4.328810604912902668951e2) * z + 4.853903996359136964868e2) * z + 1.945506571482613964425e2;
+  const double atan_ratio = (u * (z * p / q) + u) + reduced * (PI / 4);
+
+  /* Undo the swap of |y| and |x|, then move into the quadrant of (x, y). Each is angle -> offset +- angle */
+  const bool swapped = ay > ax;
+  const double first_quadrant = (swapped ? -atan_ratio : atan_ratio) + (swapped ? PI / 2 : 0.0);
+  const double upper_half = (x < 0 ? -first_quadrant : first_quadrant) + (x < 0 ? PI : 0.0);
+  return (y < 0 ? -upper_half : upper_half) * (180 / PI);
+}
+
+/* get_az_el for n points, given days since 2000-01-00 and hours since UTC midnight. Also writes the
+   unit vector towards the sun in local east, north, up coordinates */
+__attribute__((always_inline))
+inline void az_el(const double* __restrict days, const double* __restrict uth, const double* __restrict lat,
+                  const double* __restrict lon, const double* __restrict alt, double* __restrict az,
+                  double* __restrict el, double* __restrict east, double* __restrict north,
+                  double* __restrict up, size_t n) {
+  double sin_tilt, cos_tilt;
+  sincos_degrees(23.4406, &sin_tilt, &cos_tilt);
+
+  for (size_t i = 0; i < n; i++) {
+    const double d = days[i];
+
+    // Keplerian Elements for the Sun(geocentric)
+    const double w = 282.9404 + 4.70935e-5*d;
+    const double e = 0.016709 - 1.151e-9*d;
+    const double M = 356.0470 + 0.9856002585*d;
+    const double L = w + M;
+    const double oblecl = 23.4393 - 3.563e-7*d;
+
+    // auxiliary angle
+    double sin_M, cos_M;
+    sincos_degrees(M, &sin_M, &cos_M);
+    const double E = M + (180 / PI)*e*sin_M*(1 + e*cos_M);
+
+    // rectangular coordinates in the plane of the ecliptic(x axis toward perhilion)
+    double sin_E, cos_E;
+    sincos_degrees(E, &sin_E, &cos_E);
+    const double x = cos_E - e;
+    const double y = sin_E*std::sqrt(1 - e*e);
+
+    // ecliptic coordinates, rotating (x, y) by the longitude of perihelion rather than adding angles
+    double sin_w, cos_w;
+    sincos_degrees(w, &sin_w, &cos_w);
+    const double xeclip = x*cos_w - y*sin_w;
+    const double yeclip = x*sin_w + y*cos_w;
+
+    // rotate these coordinates to equitorial rectangular coordinates
+    // The obliquity stays within a degree of 23.44 for millennia, so its cosine needs no reduction
+    const double cos_oblecl = cos_degrees_reduced(oblecl);
+    const double xequat = xeclip;
+    const double yequat = yeclip*cos_oblecl;
+    // As in get_az_el, z uses the fixed 23.4406 degree tilt rather than the obliquity
+    const double zequat = yeclip*sin_tilt;
+
+    // RA and Decl as sine/cosine pairs
+    const double r = std::sqrt(xequat*xequat + yequat*yequat + zequat*zequat) - (alt[i] / 149598000);
+    const double inverse_rxy = 1 / std::sqrt(xequat*xequat + yequat*yequat);
+    const double cos_RA = xequat * inverse_rxy;
+    const double sin_RA = yequat * inverse_rxy;
+    const double sin_delta = zequat / r;
+    const double cos_delta = std::sqrt(std::max(0.0, 1 - sin_delta*sin_delta));
+
+    // local siderial time in degrees, and the hour angle HA = SIDTIME - RA
+    double sin_sid, cos_sid;
+    sincos_degrees(L + 180 + uth[i]*15 + lon[i], &sin_sid, &cos_sid);
+    const double cos_HA = cos_sid*cos_RA + sin_sid*sin_RA;
+    const double sin_HA = sin_sid*cos_RA - cos_sid*sin_RA;
+
+    // convert to rectangular coordinate system
+    const double xh = cos_HA*cos_delta;
+    const double yh = sin_HA*cos_delta;
+    const double zh = sin_delta;
+
+    // rotate this along an axis going east - west.
+    double sin_lat, cos_lat;
+    sincos_degrees(lat[i], &sin_lat, &cos_lat);
+    const double xhor = xh*sin_lat - zh*cos_lat;
+    const double yhor = yh;
+    const double zhor = xh*cos_lat + zh*sin_lat;
+
+    // Find the h and AZ. The azimuth is measured from the -x axis, so the sun is at (-yhor, -xhor, zhor)
+    az[i] = atan2_degrees(yhor, xhor) + 180;
+    el[i] = atan2_degrees(zhor, std::sqrt(xhor*xhor + yhor*yhor));
+    east[i] = -yhor;
+    north[i] = -xhor;
+    up[i] = zhor;
+  }
+}
+
+void az_el_scalar(const double* days, const double* uth, const double* lat, const double* lon, const double* alt,
+                  double* az, double* el, double* east, double* north, double* up, size_t n) {
+  az_el(days, uth, lat, lon, alt, az, el, east, north, up, n);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTILS_BATCH_X86 1
+
+__attribute__((target("avx2")))
+void az_el_avx2(const double* days, const double* uth, const double* lat, const double* lon, const double* alt,
+                double* az, double* el, double* east, double* north, double* up, size_t n) {
+  az_el(days, uth, lat, lon, alt, az, el, east, north, up, n);
+}
+
+__attribute__((target("avx512f")))
+void az_el_avx512(const double* days, const double* uth, const double* lat, const double* lon, const double* alt,
+                  double* az, double* el, double* east, double* north, double* up, size_t n) {
+  az_el(days, uth, lat, lon, alt, az, el, east, north, up, n);
+}
+#endif
+
+}  // namespace
+
+/* Runs the kernel over blocks small enough for the integer time arithmetic of get_az_el to stay on the
+   stack. Without sun vector outputs, they go to scratch space on the stack too */
+static void az_el_blocks(const time_t* utc_time_points, const double* lat, const double* lon, const double* alt,
+                         double* az, double* el, double* east, double* north, double* up, size_t n,
+                         SimdLevel level) {
+  level = clamp_simd_level(level);
+
+  constexpr size_t BLOCK = 512;
+  double days[BLOCK];
+  double uth[BLOCK];
+  double scratch[3][BLOCK];
+  for (size_t begin = 0; begin < n; begin += BLOCK) {
+    const size_t count = std::min(BLOCK, n - begin);
+    for (size_t i = 0; i < count; i++) {
+      const time_t utc_time_point = utc_time_points[begin + i];
+      days[i] = julian_day(utc_time_point) - 2451543.5;
+      const time_t seconds_of_day = ((utc_time_point % 86400) + 86400) % 86400;
+      uth[i] = static_cast<double>(seconds_of_day) / 3600;
+    }
+
+    double* block_east = east ? east + begin : scratch[0];
+    double* block_north = north ? north + begin : scratch[1];
+    double* block_up = up ? up + begin : scratch[2];
+#ifdef UTILS_BATCH_X86
+    if (level == SimdLevel::Avx512) {
+      az_el_avx512(days, uth, lat + begin, lon + begin, alt + begin, az + begin, el + begin,
+                   block_east, block_north, block_up, count);
+      continue;
+    }
+    if (level == SimdLevel::Avx2) {
+      az_el_avx2(days, uth, lat + begin, lon + begin, alt + begin, az + begin, el + begin,
+                 block_east, block_north, block_up, count);
+      continue;
+    }
+#endif
+    az_el_scalar(days, uth, lat + begin, lon + begin, alt + begin, az + begin, el + begin,
+                 block_east, block_north, block_up, count);
+  }
+}
+
+void get_az_el_batch(std::span<const time_t> utc_time_points, std::span<const double> lat,
+                     std::span<const double> lon, std::span<const double> alt, std::span<double> az,
+                     std::span<double> el, SimdLevel level) {
+  const size_t n = az.size();
+  RUNTIME_EXCEPTION(utc_time_points.size() == n && lat.size() == n && lon.size() == n && alt.size() == n &&
+                    el.size() == n, "Batch sun position inputs and outputs must all have the same length");
+  az_el_blocks(utc_time_points.data(), lat.data(), lon.data(), alt.data(), az.data(), el.data(),
+               nullptr, nullptr, nullptr, n, level);
+}
+
+void get_az_el_batch(std::span<const time_t> utc_time_points, std::span<const double> lat,
+                     std::span<const double> lon, std::span<const double> alt, std::span<double> az,
+                     std::span<double> el, std::span<double> east, std::span<double> north, std::span<double> up,
+                     SimdLevel level) {
+  const size_t n = az.size();
+  RUNTIME_EXCEPTION(utc_time_points.size() == n && lat.size() == n && lon.size() == n && alt.size() == n &&
+                    el.size() == n && east.size() == n && north.size() == n && up.size() == n,
+                    "Batch sun position inputs and outputs must all have the same length");
+  az_el_blocks(utc_time_points.data(), lat.data(), lon.data(), alt.data(), az.data(), el.data(),
+               east.data(), north.data(), up.data(), n, level);
+}
@@ -0,0 +1,135 @@
+/* Checks that get_az_el_batch agrees with get_az_el to the documented 1e-9 degrees at every SIMD level,
+   over every cell of the forecast grid and over random times and places.
+
+   Azimuth is measured as an angle on the sky, i.e. scaled by cos(elevation), since near the zenith a
+   tiny change in the sun's position swings the azimuth arbitrarily. The east, north, up vector is held
+   to the same bound, converted to radians.
+
+   Usage: ./az_el_batch_test <dni csv>
+*/
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Luts.hpp"
+#include "Utils.hpp"
+
+namespace {
+
+/* Documented agreement between get_az_el_batch and get_az_el, in degrees */
+constexpr double MAX_ERROR_DEGREES = 1e-9;
+
+/* Points to check, with get_az_el's answers */
+struct Points {
+  std::vector<time_t> times;
+  std::vector<double> lat, lon, alt;
+  std::vector<double> az, el;
+
+  void add(time_t time, double latitude, double longitude, double altitude) {
+    times.push_back(time);
+    lat.push_back(latitude);
+    lon.push_back(longitude);
+    alt.push_back(altitude);
+    double azimuth, elevation;
+    get_az_el(time, latitude, longitude, altitude, &azimuth, &elevation);
+    az.push_back(azimuth);
+    el.push_back(elevation);
+  }
+};
+
+/* Run both overloads at every level and return the number of points off by more than the bound */
+size_t check_points(const char* set_name, const Points& points) {
+  const size_t n = points.times.size();
+  const double radians_per_degree = M_PI / 180.0;
+
+  size_t failures = 0;
+  for (const SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+    std::vector<double> az(n), el(n), vec_az(n), vec_el(n), east(n), north(n), up(n);
+    get_az_el_batch(points.times, points.lat, points.lon, points.alt, az, el, level);
+    get_az_el_batch(points.times, points.lat, points.lon, points.alt, vec_az, vec_el, east, north, up, level);
+
+    double worst = 0.0;
+    for (size_t i = 0; i < n; i++) {
+      const double cos_el = cos(points.el[i] * radians_per_degree);
+      double error = 0.0;
+      for (const auto& [batch_az, batch_el] : {std::pair{az[i], el[i]}, std::pair{vec_az[i], vec_el[i]}}) {
+        const double az_error = std::remainder(batch_az - points.az[i], 360.0);
+        error = std::max(error, std::abs(az_error) * cos_el);
+        error = std::max(error, std::abs(batch_el - points.el[i]));
+      }
+
+      const double expected_east = cos_el * sin(points.az[i] * radians_per_degree);
+      const double expected_north = cos_el * cos(points.az[i] * radians_per_degree);
+      const double expected_up = sin(points.el[i] * radians_per_degree);
+      const double vector_error = std::max({std::abs(east[i] - expected_east), std::abs(north[i] - expected_north),
+                                            std::abs(up[i] - expected_up)});
+      error = std::max(error, vector_error / radians_per_degree);
+
+      // Also catches NaN, which fails every comparison
+      if (!(error <= MAX_ERROR_DEGREES)) {
+        if (failures < 10) {
+          printf("FAIL %s %s point %zu (time %lld, lat %.6f, lon %.6f): off by %.3g degrees\n", set_name,
+                 simd_level_name(level), i, static_cast<long long>(points.times[i]), points.lat[i], points.lon[i], error);
+        }
+        failures++;
+      }
+      if (error > worst) worst = error;
+    }
+    printf("%s %s: %zu points, worst error %.3g degrees\n", set_name, simd_level_name(level), n, worst);
+  }
+  return failures;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s <dni csv>\n", argv[0]);
+    return 2;
+  }
+  printf("CPU supports up to %s. Higher levels fall back to it\n", simd_level_name(detect_simd_level()));
+
+  /* Every cell of the forecast grid, as the sun geometry tables see it */
+  ForecastLut forecast{std::string(argv[1])};
+  Points grid;
+  for (size_t row = 0; row < forecast.get_num_rows(); row++) {
+    const ForecastCoord& coord = forecast.get_row_coord(row);
+    for (size_t col = 0; col < forecast.get_num_cols(); col++) {
+      grid.add(forecast.get_column_time(col), coord.lat, coord.lon, 0.0);
+    }
+  }
+
+  /* Random times over a few decades and places anywhere on earth, at odd lengths to exercise the tails */
+  std::mt19937_64 rng(45);
+  std::uniform_int_distribution<time_t> time_dist(946684800, 2524608000);  // 2000 to 2050
+  std::uniform_real_distribution<double> lat_dist(-89.0, 89.0);
+  std::uniform_real_distribution<double> lon_dist(-180.0, 180.0);
+  std::uniform_real_distribution<double> alt_dist(0.0, 3.0);  // km
+  Points random;
+  for (size_t i = 0; i < 100003; i++) {
+    random.add(time_dist(rng), lat_dist(rng), lon_dist(rng), alt_dist(rng));
+  }
+
+  size_t failures = check_points("grid", grid);
+  failures += check_points("random", random);
+
+  for (size_t n = 0; n <= 9; n++) {
+    Points tail;
+    for (size_t i = 0; i < n; i++) tail.add(time_dist(rng), lat_dist(rng), lon_dist(rng), alt_dist(rng));
+    failures += check_points(("length " + std::to_string(n)).c_str(), tail);
+  }
+
+  if (failures > 0) {
+    printf("%zu points differ from get_az_el by more than %g degrees\n", failures, MAX_ERROR_DEGREES);
+    return 1;
+  }
+  printf("All points within %g degrees of get_az_el\n", MAX_ERROR_DEGREES);
+  return 0;
+}
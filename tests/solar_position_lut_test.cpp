@@ -0,0 +1,158 @@
+/* Checks SolarPositionLut on the default grid over a forecast:
+   - lookups at times and places between the nodes are within the documented 0.0011 degrees of get_az_el,
+     in elevation and in azimuth as an angle on the sky
+   - a table saved and loaded again, or read back from its cache file, has the same domain and gives
+     bitwise the same lookups
+
+   Usage: ./solar_position_lut_test <dni csv>
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Luts.hpp"
+#include "Utils.hpp"
+
+namespace {
+
+/* Documented agreement between the table and get_az_el on the default grid, in degrees */
+constexpr double MAX_ERROR_DEGREES = 0.0011;
+
+/* Off grid lookups to check, inside the forecast's region and span */
+struct Sample {
+  double lat;
+  double lon;
+  time_t time;
+};
+
+std::vector<Sample> make_samples(const ForecastLut& forecast, size_t n, std::mt19937_64& rng) {
+  double min_lat = INFINITY, max_lat = -INFINITY, min_lon = INFINITY, max_lon = -INFINITY;
+  for (size_t row = 0; row < forecast.get_num_rows(); row++) {
+    const ForecastCoord& coord = forecast.get_row_coord(row);
+    min_lat = std::min(min_lat, coord.lat);
+    max_lat = std::max(max_lat, coord.lat);
+    min_lon = std::min(min_lon, coord.lon);
+    max_lon = std::max(max_lon, coord.lon);
+  }
+  std::uniform_real_distribution<double> lat_dist(min_lat, max_lat);
+  std::uniform_real_distribution<double> lon_dist(min_lon, max_lon);
+  std::uniform_int_distribution<time_t> time_dist(forecast.get_column_time(0),
+                                                  forecast.get_column_time(forecast.get_num_cols() - 1));
+
+  std::vector<Sample> samples;
+  for (size_t i = 0; i < n; i++) {
+    samples.push_back(Sample{lat_dist(rng), lon_dist(rng), time_dist(rng)});
+  }
+  return samples;
+}
+
+/* Number of samples whose lookup is off by more than the bound */
+size_t check_accuracy(const SolarPositionLut& lut, const std::vector<Sample>& samples) {
+  size_t failures = 0;
+  double worst_elevation = 0.0;
+  double worst_azimuth = 0.0;
+  for (const Sample& sample : samples) {
+    double azimuth, elevation;
+    get_az_el(sample.time, sample.lat, sample.lon, 0.0, &azimuth, &elevation);
+    const SunPosition sun = lut.get_position(sample.lat, sample.lon, static_cast<double>(sample.time));
+
+    const double elevation_error = std::abs(sun.elevation - elevation);
+    const double azimuth_error = std::abs(std::remainder(sun.azimuth - azimuth, 360.0)) * cos(elevation * PI / 180);
+    worst_elevation = std::max(worst_elevation, elevation_error);
+    worst_azimuth = std::max(worst_azimuth, azimuth_error);
+
+    // Also catches NaN, which fails every comparison
+    if (!(elevation_error <= MAX_ERROR_DEGREES) || !(azimuth_error <= MAX_ERROR_DEGREES)) {
+      if (failures < 10) {
+        printf("FAIL lat %.6f lon %.6f time %lld: azimuth %.6f elevation %.6f, get_az_el %.6f %.6f\n", sample.lat,
+               sample.lon, static_cast<long long>(sample.time), sun.azimuth, sun.elevation, azimuth, elevation);
+      }
+      failures++;
+    }
+  }
+  printf("%zu lookups, worst elevation error %.3g degrees, worst azimuth error %.3g degrees on the sky\n",
+         samples.size(), worst_elevation, worst_azimuth);
+  return failures;
+}
+
+/* Number of samples where two tables give different lookups, or the number of samples if their domains differ */
+size_t check_identical(const char* what, const SolarPositionLut& expected, const SolarPositionLut& actual,
+                       const std::vector<Sample>& samples) {
+  if (!actual.same_domain(expected)) {
+    printf("FAIL %s: domain differs\n", what);
+    return samples.size();
+  }
+  size_t failures = 0;
+  for (const Sample& sample : samples) {
+    const double time = static_cast<double>(sample.time);
+    const SunPosition a = expected.get_position(sample.lat, sample.lon, time);
+    const SunPosition b = actual.get_position(sample.lat, sample.lon, time);
+    for (const auto& [x, y] : {std::pair{a.azimuth, b.azimuth}, std::pair{a.elevation, b.elevation},
+                               std::pair{a.east, b.east}, std::pair{a.north, b.north}, std::pair{a.up, b.up}}) {
+      if (std::bit_cast<uint64_t>(x) != std::bit_cast<uint64_t>(y)) {
+        if (failures < 10) printf("FAIL %s: lookup at time %lld differs\n", what, static_cast<long long>(sample.time));
+        failures++;
+        break;
+      }
+    }
+  }
+  printf("%s: %zu lookups compared\n", what, samples.size());
+  return failures;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s <dni csv>\n", argv[0]);
+    return 2;
+  }
+
+  /* Work on a copy of the forecast in a scratch directory, since the cache file goes next to it */
+  const std::filesystem::path scratch =
+      std::filesystem::temp_directory_path() / ("solar_position_lut_test_" + std::to_string(getpid()));
+  std::filesystem::create_directories(scratch);
+  const std::filesystem::path forecast_path = scratch / "dni.csv";
+  std::filesystem::copy_file(argv[1], forecast_path, std::filesystem::copy_options::overwrite_existing);
+
+  ForecastLut forecast{forecast_path.string()};
+  std::mt19937_64 rng(47);
+  const std::vector<Sample> samples = make_samples(forecast, 200000, rng);
+
+  const SolarPositionLut lut(forecast);
+  size_t failures = check_accuracy(lut, samples);
+
+  const std::filesystem::path saved_path = scratch / "saved.sun";
+  lut.save(saved_path);
+  failures += check_identical("save and load", lut, SolarPositionLut(saved_path), samples);
+
+  /* The first call builds the table and writes the cache file, the second reads it */
+  const SolarPositionLut built = SolarPositionLut::cached(forecast);
+  failures += check_identical("cache build", lut, built, samples);
+  if (!std::filesystem::exists(SolarPositionLut::cache_path(forecast_path))) {
+    printf("FAIL cache file was not written\n");
+    failures++;
+  }
+  failures += check_identical("cache file", lut, SolarPositionLut(SolarPositionLut::cache_path(forecast_path)),
+                              samples);
+  failures += check_identical("cache read", lut, SolarPositionLut::cached(forecast), samples);
+
+  std::filesystem::remove_all(scratch);
+
+  if (failures > 0) {
+    printf("%zu checks failed\n", failures);
+    return 1;
+  }
+  printf("All lookups within %g degrees of get_az_el and identical after a round trip\n", MAX_ERROR_DEGREES);
+  return 0;
+}
@@ -0,0 +1,173 @@
+/* Checks the inverse of the energy model, for the compile time production car and a runtime car:
+   - speed_for_energy returns a speed at which the stretch draws the given battery energy
+   - speed_for_energy_batch agrees with it at every SIMD level, NaN lanes included, on short lengths that
+     exercise the vector tails and on one long odd length
+
+   Usage: ./speed_for_energy_test, or ./speed_for_energy_test zero-distance-scalar|zero-distance-batch
+   to pass a zero length stretch, which must be rejected
+*/
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "Car.hpp"
+#include "Utils.hpp"
+
+namespace {
+
+/* speed_for_energy_batch agrees with the closed form of speed_for_energy to about this, relative */
+constexpr double MAX_BATCH_ERROR = 1e-12;
+
+/* Battery energy at the returned speed matches the budget to this, relative to the gross energy terms */
+constexpr double MAX_ROUND_TRIP_ERROR = 1e-9;
+
+/* Stretches to solve. Most budgets are what some speed draws, so a solution exists. The rest are
+   arbitrary budgets under a dim sky, where many have none */
+struct Stretches {
+  std::vector<double> energy, distance, angle, sin_grade, irradiance;
+};
+
+template <typename CarType>
+Stretches make_stretches(const CarType& car, size_t n, std::mt19937_64& rng) {
+  std::uniform_real_distribution<double> speed_dist(1.0, 40.0);
+  std::uniform_real_distribution<double> distance_dist(10.0, 5000.0);
+  std::uniform_real_distribution<double> angle_dist(-0.15, 0.15);
+  std::uniform_real_distribution<double> irradiance_dist(0.0, 1200.0);
+  std::uniform_real_distribution<double> dim_irradiance_dist(0.0, 100.0);
+  std::uniform_real_distribution<double> energy_dist(-5e5, 5e5);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+  Stretches s;
+  for (size_t i = 0; i < n; i++) {
+    const double distance = distance_dist(rng);
+    const double angle = angle_dist(rng);
+    double irradiance, energy;
+    if (unit(rng) < 0.8) {
+      const double speed = speed_dist(rng);
+      irradiance = irradiance_dist(rng);
+      energy = -car.energy_consumption(speed, angle, irradiance) * distance / speed;
+    } else {
+      irradiance = dim_irradiance_dist(rng);
+      energy = energy_dist(rng);
+    }
+    s.energy.push_back(energy);
+    s.distance.push_back(distance);
+    s.angle.push_back(angle);
+    s.sin_grade.push_back(sin(angle));
+    s.irradiance.push_back(irradiance);
+  }
+  return s;
+}
+
+/* Check the scalar inverse against the forward model and the batch inverse against the scalar one,
+   returning the number of failed stretches */
+template <typename CarType>
+size_t check_car(const char* car_name, const CarType& car, std::mt19937_64& rng) {
+  const PowerCoefficients k = car.get_power_coefficients();
+
+  std::vector<size_t> lengths;
+  for (size_t n = 0; n <= 9; n++) lengths.push_back(n);
+  lengths.push_back(100001);
+
+  size_t failures = 0;
+  size_t solved = 0;
+  size_t total = 0;
+  double worst_round_trip = 0.0;
+  double worst_batch = 0.0;
+  auto fail = [&](const char* what, size_t n, size_t i, double got, double expected) {
+    if (failures < 10) {
+      printf("FAIL %s %s n=%zu stretch %zu: got %.17g, expected %.17g\n", car_name, what, n, i, got, expected);
+    }
+    failures++;
+  };
+
+  for (const size_t n : lengths) {
+    const Stretches s = make_stretches(car, n, rng);
+
+    std::vector<double> expected(n);
+    for (size_t i = 0; i < n; i++) {
+      expected[i] = car.speed_for_energy(s.energy[i], s.distance[i], s.angle[i], s.irradiance[i]);
+      total++;
+      if (std::isnan(expected[i])) continue;
+      solved++;
+
+      // Battery energy over the stretch at the returned speed, against the gross terms that sum to it
+      const double v = expected[i];
+      const double drawn = -car.energy_consumption(v, s.angle[i], s.irradiance[i]) * s.distance[i] / v;
+      const double gross = (k.cubic * v * v * v + k.linear * v + std::abs(k.grade * s.sin_grade[i]) * v +
+                            k.constant + k.solar * s.irradiance[i]) * s.distance[i] / v;
+      const double error = std::abs(drawn - s.energy[i]) / gross;
+      worst_round_trip = std::max(worst_round_trip, error);
+      if (!(v > 0) || !(error <= MAX_ROUND_TRIP_ERROR)) fail("round trip", n, i, drawn, s.energy[i]);
+    }
+
+    for (const SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+      std::vector<double> out(n);
+      speed_for_energy_batch(car.params(), s.energy, s.distance, s.sin_grade, s.irradiance, out, level);
+      for (size_t i = 0; i < n; i++) {
+        if (std::isnan(expected[i]) || std::isnan(out[i])) {
+          if (std::isnan(expected[i]) != std::isnan(out[i])) fail(simd_level_name(level), n, i, out[i], expected[i]);
+          continue;
+        }
+        const double error = std::abs(out[i] - expected[i]) / expected[i];
+        worst_batch = std::max(worst_batch, error);
+        if (!(error <= MAX_BATCH_ERROR)) fail(simd_level_name(level), n, i, out[i], expected[i]);
+      }
+    }
+  }
+  printf("%s: %zu of %zu stretches solvable, worst round trip error %.3g, worst batch error %.3g\n", car_name,
+         solved, total, worst_round_trip, worst_batch);
+  return failures;
+}
+
+/* Solve one zero length stretch, which must exit with an error before returning */
+int solve_zero_distance(bool batch) {
+  const ProductionCar car;
+  const double energy = 1000.0, distance = 0.0, sin_grade = 0.0, irradiance = 800.0;
+  double speed = 0.0;
+  if (batch) {
+    speed_for_energy_batch(car.params(), std::span(&energy, 1), std::span(&distance, 1), std::span(&sin_grade, 1),
+                           std::span(&irradiance, 1), std::span(&speed, 1));
+  } else {
+    speed = car.speed_for_energy(energy, distance, 0.0, irradiance);
+  }
+  printf("Zero length stretch was not rejected, solved to %g m/s\n", speed);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) {
+    if (strcmp(argv[1], "zero-distance-scalar") == 0) return solve_zero_distance(false);
+    if (strcmp(argv[1], "zero-distance-batch") == 0) return solve_zero_distance(true);
+    printf("Unknown mode %s\n", argv[1]);
+    return 2;
+  }
+  printf("CPU supports up to %s. Higher levels fall back to it\n", simd_level_name(detect_simd_level()));
+  std::mt19937_64 rng(37);
+
+  CarParams custom;
+  custom.cda = 0.11;
+  custom.car_mass = 240.0;
+  custom.rolling_resistance = 0.0031;
+  custom.array_area = 4.4;
+  custom.motor_efficiency = 0.93;
+  custom.passive_loss = 35.5;
+
+  size_t failures = check_car("ProductionCar", ProductionCar(), rng);
+  failures += check_car("Car", Car(custom), rng);
+
+  if (failures > 0) {
+    printf("%zu stretches failed\n", failures);
+    return 1;
+  }
+  printf("All stretches agree\n");
+  return 0;
+}